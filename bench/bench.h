@@ -0,0 +1,59 @@
+/* what the benchmarks share: a clock, a file read whole and synthetic text
+ * built from a table of lines. included after ../ctrlc.c */
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+double benchNow() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+char* benchRead(const char* path, size_t* len) {
+	FILE* fp = fopen(path, "r");
+	if (fp == NULL) {
+		perror(path);
+		exit(1);
+	}
+
+	fseek(fp, 0, SEEK_END);
+	*len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	char* buf = malloc(*len + 1);
+	if (buf == NULL || fread(buf, 1, *len, fp) != *len) {
+		perror(path);
+		exit(1);
+	}
+	buf[*len] = '\0';
+	fclose(fp);
+
+	return buf;
+}
+
+/* about cap bytes of the num lines repeated over and over; each line is
+ * printed with the number of its round through the table and a second,
+ * scattered number for the lines that take one */
+char* benchSynth(const char* lines[], int num, size_t cap, size_t* len) {
+	char* buf = malloc(cap + 256);
+	if (buf == NULL) {
+		perror("benchSynth");
+		exit(1);
+	}
+	size_t n = 0;
+
+	for (int i = 0; n < cap; ++i) {
+		n += sprintf(buf + n, lines[i % num], i / num, i * 7 % 1000);
+	}
+	buf[n] = '\0';
+	*len = n;
+
+	return buf;
+}
+
+#endif
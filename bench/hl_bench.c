@@ -0,0 +1,102 @@
+/* highlighting throughput benchmark, then the comment states of the whole
+ * file settled by the idle walk and by the parallel pass on 1 to
+ * HL_MAX_WORKERS threads, which must agree row for row.
+ * build and run with `make bench`, or pass a file: ./hl_bench big.c */
+#define main ctrlc_main
+#include "../ctrlc.c"
+#undef main
+
+#include "bench.h"
+
+#define BENCH_ROUNDS 5
+
+/* C that exercises keywords, numbers, strings and comments */
+static const char* benchLines[] = {
+	"static int value_%d = compute(%d, \"string literal\"); /* block */ // tail\n",
+	"\tfor (unsigned long i = 0; i < count_%d; ++i) { total += %d.5; }\n",
+	"struct node_%d { char* name; double weight; void* next; }; // %d\n",
+	"\tif (flags & %d) return; else while (x_%d) continue;\n",
+};
+
+int main(int argc, char* argv[]) {
+	size_t len;
+	char* text = argc > 1 ? benchRead(argv[1], &len) : benchSynth(benchLines, 4, 64 << 20, &len);
+
+	E.filename = argc > 1 ? argv[1] : "bench.c"; //the extension picks the syntax
+	editorSelectSyntaxHighlight();
+
+	unsigned char* hl = malloc(len + 1);
+	double best = 0;
+
+	for (int round = 0; round < BENCH_ROUNDS; ++round) {
+		struct timespec t0, t1;
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+
+		int in_comment = 0;
+		size_t start = 0;
+		while (start < len) {
+			char* nl = memchr(text + start, '\n', len - start);
+			size_t end = nl ? (size_t)(nl - text) : len;
+
+			in_comment = editorSyntaxLex(text + start, end - start, hl + start, in_comment);
+			start = end + 1;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+		double mbs = len / secs / (1 << 20);
+		if (mbs > best) best = mbs;
+	}
+
+	printf("highlight %.1f MB: %.1f MB/s (best of %d)\n", len / (double)(1 << 20), best, BENCH_ROUNDS);
+	free(hl);
+
+	E.rowtree = rtNewNode(1);
+	E.hl_pending = -1;
+	E.hl_dirty_end = -1;
+	E.map = text;
+	E.map_size = len;
+	size_t pos = 0;
+	while (pos < len) {
+		char* nl = memchr(&text[pos], '\n', len - pos);
+		size_t end = nl ? (size_t)(nl - text) : len;
+		editorInsertMappedRow(E.numrows, pos, end - pos);
+		pos = end + 1;
+	}
+
+	double start = benchNow();
+	while (!editorSyntaxSettle(E.numrows - 1, HL_IDLE_SLICE));
+	double serial = benchNow() - start;
+	printf("settle %d rows, idle walk: %.1f ms\n", E.numrows, serial * 1000);
+
+	unsigned char* states = malloc(E.numrows);
+	erow* row = editorRowAt(0);
+	for (int i = 0; row; ++i, row = editorRowNext(row)) {
+		states[i] = row->hl_open_comment;
+	}
+
+	for (int workers = 1; workers <= HL_MAX_WORKERS; workers *= 2) {
+		for (row = editorRowAt(0); row; row = editorRowNext(row)) {
+			row->hl_open_comment = 2; //neither state, every row has to be lexed
+		}
+		E.hl_frontier = 0;
+
+		start = benchNow();
+		editorSyntaxSettleParallel(workers, 0);
+		double secs = benchNow() - start;
+
+		int same = E.hl_frontier == E.numrows;
+		row = editorRowAt(0);
+		for (int i = 0; row && same; ++i, row = editorRowNext(row)) {
+			same = states[i] == row->hl_open_comment;
+		}
+		printf("settle, %d workers: %.1f ms, %.2fx the walk, %s\n", workers, secs * 1000, serial / secs,
+				same ? "same states" : "STATES DIFFER");
+	}
+	printf("%ld cores online\n", sysconf(_SC_NPROCESSORS_ONLN));
+
+	free(states);
+	free(text);
+
+	return 0;
+}
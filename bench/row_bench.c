@@ -0,0 +1,109 @@
+/* memory a line costs: heap bytes per row right after a file is split
+ * into rows, once every row holds its own text the way edited or pasted
+ * rows do, and what render and hl add for each row drawn; then how long
+ * splitting and closing the rows take. build and run with `make bench`,
+ * or pass a file: ./row_bench big.c */
+#define main ctrlc_main
+#include "../ctrlc.c"
+#undef main
+
+#include <malloc.h>
+#include <sys/resource.h>
+
+#include "bench.h"
+
+/* C shaped code: blank lines, braces and statements of the lengths real
+ * sources have */
+static const char* benchLines[] = {
+	"/* helper number %d */\n",
+	"static int helper_%d(struct node* n, int depth) {\n",
+	"\tint total = %d;\n",
+	"\n",
+	"\tfor (int i = 0; i < n->count; ++i) {\n",
+	"\t\tif (n->child[i] == NULL) continue;\n",
+	"\t\ttotal += helper_%d(n->child[i], depth + 1);\n",
+	"\t}\n",
+	"\n",
+	"\treturn total;\n",
+	"}\n",
+	"\n",
+};
+
+size_t benchHeap() {
+	return mallinfo2().uordblks;
+}
+
+void benchSplit(char* text, size_t len) {
+	size_t pos = 0;
+	while (pos < len) {
+		char* nl = memchr(&text[pos], '\n', len - pos);
+		size_t end = nl ? (size_t)(nl - text) : len;
+		editorInsertMappedRow(E.numrows, pos, end - pos);
+		pos = end + 1;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	size_t len;
+	char* text = argc > 1 ? benchRead(argv[1], &len) : benchSynth(benchLines, 12, 16 << 20, &len);
+
+	E.filename = argc > 1 ? argv[1] : "bench.c";
+	editorSelectSyntaxHighlight();
+	E.screenrows = 50;
+	E.screencols = 120;
+	J.fd = -1; //no journal to close with the rows
+
+	/* split the text the way editorOpen splits a mapped file */
+	size_t base = benchHeap();
+	E.rowtree = rtNewNode(1);
+	E.hl_pending = -1;
+	E.hl_dirty_end = -1;
+	E.map = text;
+	E.map_size = len;
+	E.map_heap = 1; //closing the rows frees it
+	double start = benchNow();
+	benchSplit(text, len);
+	double split = benchNow() - start;
+	size_t mapped = benchHeap() - base;
+
+	erow* row = editorRowAt(0);
+	for (; row; row = editorRowNext(row)) {
+		editorRowMaterialize(row);
+	}
+	size_t owned = benchHeap() - base;
+
+	row = editorRowAt(0);
+	for (int i = 0; row && i < E.screenrows; ++i, row = editorRowNext(row)) {
+		editorRowPrepare(row, i);
+	}
+	size_t drawn = benchHeap() - base;
+
+	printf("%d rows, %.1f bytes of text a row, erow of %zu bytes\n", E.numrows, len / (double)E.numrows, sizeof(erow));
+	printf("mapped: %.1f bytes/row\n", mapped / (double)E.numrows);
+	printf("own text: %.1f bytes/row\n", owned / (double)E.numrows);
+	printf("render and hl: %.1f bytes/drawn row\n", (drawn - owned) / (double)E.screenrows);
+
+	editorShowRowStats();
+	printf("%s\n", E.statusmsg);
+
+	start = benchNow();
+	editorFreeRows();
+	double teardown = benchNow() - start;
+
+	/* a second split starts from empty slabs, as a file opened after the
+	 * first one was closed would */
+	text = argc > 1 ? benchRead(argv[1], &len) : benchSynth(benchLines, 12, 16 << 20, &len);
+	E.map = text;
+	E.map_size = len;
+	E.map_heap = 1;
+	start = benchNow();
+	benchSplit(text, len);
+	double again = benchNow() - start;
+
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	printf("split: %.1f ms, close: %.1f ms, split again: %.1f ms, peak RSS %ld KB\n",
+			split * 1000, teardown * 1000, again * 1000, ru.ru_maxrss);
+
+	return 0;
+}
@@ -0,0 +1,191 @@
+/* substring search benchmark: tab expansion and strstr row by row, the way
+ * search used to work, against the search kernels scanning the whole text,
+ * then literal queries against regex ones through the rows the way a search
+ * worker scans them. build and run with `make bench`, or pass a file:
+ * ./search_bench big.c */
+#define main ctrlc_main
+#include "../ctrlc.c"
+#undef main
+
+#include "bench.h"
+
+#define BENCH_ROUNDS 5
+
+static const char* benchLines[] = {
+	"\tint value_%d = compute(%d, \"string literal\"); /* block */ // tail\n",
+};
+
+/* counts the lines holding query, rendering and searching each line on its own */
+long benchRows(char** rows, int numrows, const char* query) {
+	static char* scratch = NULL;
+	static int scratch_size = 0;
+	long hits = 0;
+
+	for (int i = 0; i < numrows; ++i) {
+		int size = strlen(rows[i]);
+		if (scratch_size < size * CTRLC_TAB_STOP + 1) {
+			scratch_size = size * CTRLC_TAB_STOP + 1;
+			free(scratch);
+			scratch = malloc(scratch_size);
+		}
+		editorRenderText(scratch, rows[i], size);
+		if (strstr(scratch, query)) ++hits;
+	}
+
+	return hits;
+}
+
+/* counts the lines holding query, scanning the text in one go and skipping
+ * to the next line after every hit */
+long benchChunk(searchKernel kernel, const char* text, size_t len, const char* query, int icase) {
+	long hits = 0;
+	size_t qlen = strlen(query);
+	const char* p = text;
+	const char* end = text + len;
+
+	while ((p = kernel(p, end - p, query, qlen, icase)) != NULL) {
+		++hits;
+		p = memchr(p, '\n', end - p);
+		if (p == NULL) break;
+		++p;
+	}
+
+	return hits;
+}
+
+/* matches of query over every row of the buffer in one search range */
+long benchEngine(const char* query, int regex, int icase) {
+	regexProg* prog = NULL;
+	regexCache cache;
+	memset(&cache, 0, sizeof(cache));
+
+	if (regex) {
+		const char* error = NULL;
+		prog = regexCompile(query, icase, &error);
+		if (prog == NULL) {
+			printf("%s: %s\n", query, error);
+			exit(1);
+		}
+		regexCacheReset(&cache, prog, SE.generation);
+	}
+
+	searchRange out = { 0, 0, 0, NULL };
+	editorSearchRows(0, E.numrows, prog ? prog->literal : query, prog ? prog->literal_len : (int)strlen(query),
+			icase, prog && !prog->literal_only ? &cache : NULL, SE.generation, &out);
+	free(out.matches);
+	regexCacheFree(&cache);
+	regexFree(prog);
+
+	return out.count;
+}
+
+int main(int argc, char* argv[]) {
+	size_t len;
+	char* text = argc > 1 ? benchRead(argv[1], &len) : benchSynth(benchLines, 1, 64 << 20, &len);
+
+	/* the rows as separate NUL terminated strings */
+	char* copy = malloc(len + 1);
+	memcpy(copy, text, len);
+	int numrows = 0;
+	for (size_t i = 0; i < len; ++i) {
+		if (text[i] == '\n') ++numrows;
+	}
+	char** rows = malloc(sizeof(char*) * (numrows + 1));
+	numrows = 0;
+	char* line = copy;
+	for (size_t i = 0; i < len; ++i) {
+		if (copy[i] == '\n') {
+			copy[i] = '\0';
+			rows[numrows++] = line;
+			line = &copy[i + 1];
+		}
+	}
+
+	struct {
+		const char* name;
+		searchKernel kernel;
+	} kernels[] = {
+		{ "scalar", searchScalar },
+#ifdef CTRLC_SIMD_X86
+		{ "sse2", searchSSE2 },
+		{ "avx2", __builtin_cpu_supports("avx2") ? searchAVX2 : NULL },
+#endif
+	};
+	const char* queries[] = { "value_99999", "no such text", "compute(", NULL };
+
+	printf("%.1f MB, %d lines\n", len / (double)(1 << 20), numrows);
+	for (int q = 0; queries[q]; ++q) {
+		double best = 1e9;
+		long hits = 0;
+		for (int r = 0; r < BENCH_ROUNDS; ++r) {
+			double t = benchNow();
+			hits = benchRows(rows, numrows, queries[q]);
+			t = benchNow() - t;
+			if (t < best) best = t;
+		}
+		printf("%-14s render+strstr   %8.1f MB/s  (%ld lines)\n", queries[q], len / best / (1 << 20), hits);
+
+		for (unsigned int k = 0; k < sizeof(kernels) / sizeof(kernels[0]); ++k) {
+			if (kernels[k].kernel == NULL) continue;
+
+			for (int icase = 0; icase <= 1; ++icase) {
+				best = 1e9;
+				for (int r = 0; r < BENCH_ROUNDS; ++r) {
+					double t = benchNow();
+					hits = benchChunk(kernels[k].kernel, text, len, queries[q], icase);
+					t = benchNow() - t;
+					if (t < best) best = t;
+				}
+				printf("%-14s %-6s%-9s %8.1f MB/s  (%ld lines)\n", queries[q], kernels[k].name,
+						icase ? " nocase" : "", len / best / (1 << 20), hits);
+			}
+		}
+	}
+
+	/* the rows pointing into the text, as editorOpen leaves them */
+	E.rowtree = rtNewNode(1);
+	E.hl_pending = -1;
+	E.hl_dirty_end = -1;
+	E.map = text;
+	E.map_size = len;
+	for (size_t pos = 0; pos < len; ) {
+		char* nl = memchr(&text[pos], '\n', len - pos);
+		size_t end = nl ? (size_t)(nl - text) : len;
+		editorInsertMappedRow(E.numrows, pos, end - pos);
+		pos = end + 1;
+	}
+
+	struct {
+		const char* query;
+		int regex;
+	} engine[] = {
+		{ "compute(", 0 },
+		{ "compute\\(", 1 },
+		{ "value_[0-9]+ = compute", 1 },
+		{ "no such text", 0 },
+		{ "no such text", 1 },
+		{ "[0-9]{3}\\)", 1 },
+		{ "\\w+_\\d+\\s=", 1 },
+		{ NULL, 0 }
+	};
+	for (int q = 0; engine[q].query; ++q) {
+		for (int icase = 0; icase <= 1; ++icase) {
+			double best = 1e9;
+			long hits = 0;
+			for (int r = 0; r < BENCH_ROUNDS; ++r) {
+				double t = benchNow();
+				hits = benchEngine(engine[q].query, engine[q].regex, icase);
+				t = benchNow() - t;
+				if (t < best) best = t;
+			}
+			printf("%-24s %-7s%-9s %8.1f MB/s  (%ld matches)\n", engine[q].query,
+					engine[q].regex ? "regex" : "literal", icase ? " nocase" : "", len / best / (1 << 20), hits);
+		}
+	}
+
+	free(rows);
+	free(copy);
+	free(text);
+
+	return 0;
+}
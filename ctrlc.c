@@ -16,6 +16,17 @@
 #include <time.h>
 #include <stdarg.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CTRLC_SIMD_X86
+#include <immintrin.h>
+#endif
 
 /* defines */
 #define CTRL_KEY(k) ((k) & 0x1f) // getting the control key version of the k like ctrl + letter
@@ -23,21 +34,188 @@
 #define CTRLC_TAB_STOP 8
 #define CTRLC_QUIT_TIMES 2
 #define LINENUM_MARGIN 4
+#define ROWTREE_SLOTS 64 //max rows in a leaf or children in an inner node of the row tree
+#define SLAB_PAGE (1<<16) //bytes a slab takes from malloc at a time
+#define TEXT_SLABS 7 //size classes of row texts, see RS
+#define RENDER_CACHE_ROWS 1024 //rows that may keep render and hl before far ones are dropped
+#define HL_SYNC_BUDGET (1<<20) //bytes lexed per keystroke, what is left waits for idle time
+#define ROW_LONG (1<<14) //rows at least this long are edited through a gap and drawn through a window
+#define ROW_INLINE 16 //rows shorter than this keep their own text inside the erow
+#define ROW_GAP (1<<12) //least room a gap is opened with, it also grows with the row
+#define LEX_CHECKPOINT (1<<12) //bytes a long row is lexed between two checkpoints
+#define LEX_LOOKAHEAD 64 //bytes the lexer may read past where it stands, more than any keyword or delimiter
+#define COL_BLOCK (1<<12) //bytes of a long row summed up by one entry of its column index
+#define HL_IDLE_SLICE (1<<18) //bytes lexed per idle slice between input checks
+#define HL_CHUNK_ROWS 16384 //rows one worker lexes as a unit when the whole file is lexed at once
+#define HL_MAX_WORKERS 8
+#define SEARCH_CHUNK (1<<16) //bytes of back to back rows handed to the search kernel at once
+#define SEARCH_RANGE_ROWS 16384 //rows a search worker scans as one unit
+#define SEARCH_MAX_WORKERS 8
+#define REGEX_MAX_NODES (1<<16) //NFA size a pattern may compile to
+#define REGEX_MAX_REPEAT 1000 //largest count in {m,n}
+#define REGEX_DFA_STATES 4096 //DFA states a pass caches before it starts over
+#define REGEX_LITERAL_MAX 64
+
+#define ROW_DIRTY (1<<0) //chars changed since render and hl were built
+#define ROW_HL_IN_COMMENT (1<<1) //hl was built with the row starting inside a comment
+#define ROW_SHARED (1<<2) //chars are read by a running save and must be copied before a change
+#define ROW_HL_STALE (1<<3) //hl has to be lexed again though render still holds
+#define ROW_HELD (1<<4) //a running save reads text inside the erow, which must outlive it
+
+#define ABUF_MIN_CAP 4096
+#define INPUT_RING (1<<16) //bytes of terminal input read ahead, a power of two
+#define STATUSMSG_SECONDS 5 //how long a status message stays on the message bar
+#define PASTE_TIMEOUT_TICKS 10 //empty reads (VTIME ticks) a paste may stall before it is taken as ended
+#define LOAD_BATCH_ROWS 16384 //rows the reader thread hands over at a time
+#define LOAD_QUEUE 8 //batches the reader may get ahead of the main thread
+#define SAVE_IOV_BATCH 1024 //iovecs handed to one writev while saving
+#define SAVE_BATCH_BYTES (1<<22) //bytes handed to one writev, progress moves in these steps
+#define JOURNAL_MAGIC "CTRLCJ1\n"
+#define JOURNAL_HEADER 32 //magic, then size, mtime seconds and nanoseconds of the file the records apply to
+#define JOURNAL_BATCH (1<<16) //record bytes gathered before they are written
+#define JOURNAL_SYNC_MS 1000 //longest a record waits to be synced to disk
+#define CTRLC_UNDO_MEM (64<<20) //bytes the undo history may hold before its oldest steps are dropped
+#define ATTR_INVERSE 0x80 //cell attr bit, the low bits hold the SGR foreground colour or 0 for default
 
 #define HL_HIGHLIGHT_NUMBERS (1<<0)
 #define HL_HIGHLIGHT_STRINGS (1<<1)
+#define HL_CHAR_LITERALS (1<<2) //a ' only opens a literal closed one character or escape later, lifetimes stay plain
 
 /* data */
+/* where the lexer stands inside a row, enough to carry on from there */
+typedef struct lexState {
+	unsigned char in_comment;
+	unsigned char in_string; //the quote that opened it, or 0
+	unsigned char prev_sep;
+	unsigned char prev_hl;
+	unsigned char line_comment; //a single line comment runs to the end of the row
+} lexState;
+
+typedef struct lexPoint {
+	int pos; //byte the lexer stopped at
+	lexState state;
+} lexPoint;
+
+/* the columns a run of bytes takes. Past the first tab everything lines up
+ * with a tab stop, so the column the run ends at follows from the one it
+ * starts at with just pre and tail; a layer for wide characters would only
+ * change how the two are counted */
+typedef struct colBlock {
+	int from; //first byte and the column it starts at, valid for blocks before rowLex.blocks_valid
+	int col;
+	int bytes;
+	int pre; //columns before the first tab, or of all the bytes when there is none
+	int tail; //columns from the first tab on, counted from a tab stop
+	int tab; //the block holds a tab
+} colBlock;
+
+/* long rows keep lexer checkpoints, so an edit is lexed from the one before
+ * it until the states meet the old ones again, and a window of the row is
+ * highlighted without lexing everything to its left */
+typedef struct rowLex {
+	struct editorSyntax* syntax; //the points were lexed with this syntax
+	int in_comment; //and with the row entered in this state
+	int out; //state the row ends in
+	lexPoint* points; //sorted by pos, about LEX_CHECKPOINT bytes apart
+	int count;
+	int cap;
+	int dirty_from; //bytes from here to dirty_to changed since the points were lexed, -1 if none
+	int dirty_to;
+	int render_from; //column render[0] stands for, render holds one screen width
+	int win_col; //coloffset, screencols and incoming state the window was built for
+	int win_cols;
+	int win_comment;
+	colBlock* blocks; //column index: the row cut into runs of about COL_BLOCK bytes, built on first use
+	int num_blocks;
+	int blocks_cap;
+	int blocks_valid;
+} rowLex;
+
+/* highlighting is kept as runs of one class: a span takes the render
+ * columns from where the one before it ended up to end. Rows drawn whole
+ * are shorter than ROW_LONG, so with tabs expanded end fits in 24 bits */
+typedef struct hlSpan {
+	unsigned int end : 24;
+	unsigned int hl : 8; //stands for highlight
+} hlSpan;
+
+/* render and hl of a row in E.cached_rows, in one block: the spans, then
+ * the expanded text when render is not the text of the row itself */
+typedef struct rowCache {
+	char* render;
+	int render_size;
+	int num_spans; //they cover render from column 0 to render_size
+	int spans_cap;
+	int slot; //index in E.cached_rows
+	int expanded; //render is held in the block
+	hlSpan spans[];
+} rowCache;
+
+/* there is one erow per line, so it is kept small: render and hl only
+ * exist for rows in the cache, and a short row keeps its text where the
+ * offset into the map was */
 typedef struct erow {
-	int idx; //index for each erow within the file
+	struct rownode* leaf; //leaf of the row tree holding this row
+	char* chars; //NULL while the text is in E.map
+	union {
+		size_t src; //offset of the original text in E.map, used while chars is NULL
+		char text[ROW_INLINE]; //the text of a short row, chars points here then
+	} data;
+	rowLex* lex; //checkpoints, column index and render window of a long row, NULL until one is needed
+	rowCache* cache; //NULL unless the row is in E.cached_rows
 	int size;
-	int render_size;
-	char* chars;
-	char* render;
-	unsigned char* hl; //stands for highlight
-	int hl_open_comment;
+	unsigned char slot; //position within the leaf, row index is derived from the tree
+	unsigned char flags;
+	unsigned char hl_open_comment;
+	unsigned char text_slab; //1 + index in RS.text of the slab chars came from, 0 if they are not from one
 } erow;
 
+/* rows are kept in a counted B-tree: leaves hold row pointers, inner nodes
+ * hold children, every node knows how many rows live below it */
+typedef struct rownode {
+	struct rownode* parent;
+	struct rownode* prev; //leaf chain for sequential walks
+	struct rownode* next;
+	int leaf;
+	int count; //used slots
+	int total; //rows in the whole subtree
+	void* slot[ROWTREE_SLOTS]; //erow* in leaves, rownode* in inner nodes
+} rownode;
+
+/* hands out blocks of one size carved from pages of SLAB_PAGE bytes, with
+ * no header in front of them; freed blocks are chained through their first
+ * bytes and given out again first */
+typedef struct slab {
+	int size; //bytes a block takes
+	void* free_list;
+	char** pages;
+	int num_pages;
+	int pages_cap;
+	int used; //bytes of the newest page already handed out
+	size_t in_use; //blocks handed out and not freed
+} slab;
+
+/* row storage: erows, row tree nodes and row texts up to the largest text
+ * slab come from slabs, so a line costs no malloc header and closing a
+ * buffer gives back pages rather than freeing every row */
+struct rowStore {
+	slab rows;
+	slab nodes;
+	slab text[TEXT_SLABS];
+};
+
+struct rowStore RS = {
+	.rows = {.size = sizeof(erow)},
+	.nodes = {.size = sizeof(rownode)},
+	.text = {{.size = 32}, {.size = 48}, {.size = 64}, {.size = 96}, {.size = 128}, {.size = 192}, {.size = 256}},
+};
+
+/* one character cell of the terminal */
+typedef struct cell {
+	char ch;
+	unsigned char attr;
+} cell;
+
 struct editorConfig {
 	int cursor_x, cursor_y;
 	int render_x;
@@ -48,11 +226,35 @@ struct editorConfig {
 	struct termios orig_termios;
 	struct editorSyntax* syntax;
 	int numrows;
-	erow* row;
+	rownode* rowtree;
+	char* map; //original file text, rows point into it until they are materialized
+	size_t map_size;
+	int map_heap; //map is a malloc'd copy instead of a mapping of the file
+	int hl_frontier; //rows before it have been lexed at least once
+	int hl_pending; //first row whose hl_open_comment may be stale, -1 if none
+	int hl_dirty_end; //last row that was edited since hl_pending was set
+	int hl_provisional; //last frame drew rows whose incoming state was not settled
+	erow** cached_rows; //rows currently holding render and hl
+	int num_cached;
+	int cached_cap;
 	char* filename;
 	char statusmsg[80];
 	time_t statusmsg_time;
 	int dirty; //flag that tells us whether the file was modified or not
+	cell* frame; //cells of the frame being built
+	cell* shown; //cells the terminal shows now, frame is diffed against them
+	int frame_rows, frame_cols; //the whole terminal, bars and line numbers included
+	int repaint; //the next frame rewrites every line instead of only the changed spans
+	int shown_rowoffset; //rowoffset the shown cells were drawn with
+	int sync_output; //terminal supports synchronized output (DEC mode 2026)
+	int frames; //frame timing, shown with Ctrl-T
+	long frame_us_last;
+	long frame_us_max;
+	long long frame_us_total;
+	int frame_bytes_last;
+	int search_icase; //searches ignore case, toggled with Tab in the search prompt
+	int search_regex; //search queries are regular expressions, toggled with Ctrl-R in the search prompt
+	int hl_batch; //row updates only mark hl stale, whoever set it settles once at the end
 };
 
 enum editorKey {
@@ -65,7 +267,9 @@ enum editorKey {
 	PAGE_DOWN,
 	HOME,
 	END,
-	DELETE
+	DELETE,
+	PASTE_START, //bracketed paste, the pasted text follows
+	PASTE_END
 };
 
 enum editorHighlight {
@@ -79,6 +283,21 @@ enum editorHighlight {
 	HL_MATCH
 };
 
+typedef struct keywordSlot {
+	const char* word; //NULL for an empty slot
+	int len;
+	unsigned char hl; //HL_KEYWORD1 or HL_KEYWORD2
+} keywordSlot;
+
+/* keywords of one syntax compiled into a collision free hash table, so a
+ * lookup hashes the word once and compares against a single slot */
+typedef struct keywordTable {
+	unsigned int seed;
+	unsigned int mask;
+	int max_len;
+	keywordSlot* slots;
+} keywordTable;
+
 struct editorSyntax {
 	char* filetype;
 	char** filematch;
@@ -86,13 +305,394 @@ struct editorSyntax {
 	char* signleline_comment_start;
 	char* multiline_comment_start;
 	char* multiline_comment_end;
+	char* string_quotes; //characters that open a string closed by the same one, a ` one knows no escapes
 	int flags;
+	keywordTable* kwtable; //built from keywords the first time the syntax is selected
 };
 
 struct editorConfig E;
 
+/* terminal input is read in chunks into this ring and keys are parsed out
+ * of it, so a burst of input costs a few reads instead of one per byte */
+struct inputRing {
+	char buf[INPUT_RING];
+	unsigned int head; //next byte to hand out, both count up and wrap
+	unsigned int tail; //end of the bytes read
+};
+
+struct inputRing IN;
+
+/* the one row being edited through a gap: its chars hold the text before
+ * the gap, len unused bytes, then the rest of the text. Typing moves the gap
+ * along instead of moving the tail of the row on every key, and anything
+ * that wants the whole text gets it after editorGapClose */
+struct rowGap {
+	erow* row; //NULL while no gap is open
+	int at;
+	int len;
+};
+
+struct rowGap G;
+
+/* the main thread sleeps in poll() on the terminal and on this pipe; the
+ * SIGWINCH handler and the worker threads write a byte into it to wake it */
+struct eventLoop {
+	int wake[2]; //self-pipe, the read end is polled along with stdin
+	volatile sig_atomic_t resized; //set by the SIGWINCH handler
+	int redraw; //something on screen changed since the last frame
+};
+
+struct eventLoop EV;
+
+/* what is left to lex of a file that was just opened is cut into chunks
+ * of rows that workers lex as if each started outside a comment. The
+ * chunks are then walked in order, and the ones that really start inside
+ * one are lexed again up to the row whose state meets the guessed one */
+typedef struct hlChunk {
+	int from;
+	int to;
+	int out; //state the last row ends in when the chunk is entered outside a comment
+	int done;
+} hlChunk;
+
+struct hlPass {
+	hlChunk* chunks;
+	int num_chunks;
+	int next; //next chunk to take, taken with an atomic add
+	int stop; //input arrived, no more chunks are taken
+};
+
+struct hlPass HP;
+
+enum regexOp {
+	RE_CHAR, //consumes one byte of its set
+	RE_SPLIT, //goes on to both out and out1
+	RE_BOL, //row start
+	RE_EOL, //row end
+	RE_MATCH
+};
+
+typedef struct regexNode {
+	unsigned char op;
+	int set; //index into regexProg.sets for RE_CHAR
+	int out;
+	int out1;
+} regexNode;
+
+enum regexAstOp {
+	RA_EMPTY,
+	RA_CHAR,
+	RA_CAT,
+	RA_ALT,
+	RA_REPEAT,
+	RA_BOL,
+	RA_EOL
+};
+
+/* parsed pattern, nodes refer to each other by index */
+typedef struct regexAst {
+	unsigned char op;
+	int ch; //the byte of a plain RA_CHAR, -1 for classes
+	int set;
+	int a, b; //operands
+	int min, max; //RA_REPEAT counts, max is -1 when unbounded
+} regexAst;
+
+typedef struct regexNFA {
+	regexNode* nodes;
+	int num_nodes;
+	int cap;
+	int start; //entry of a match beginning right here
+	int loop; //entry that first skips any number of bytes
+} regexNFA;
+
+/* a search query compiled once per keystroke into Thompson NFAs that read
+ * the pattern forwards and backwards. Workers share it read only and run
+ * their own lazily built DFAs over it */
+typedef struct regexProg {
+	regexNFA fwd;
+	regexNFA rev;
+	unsigned char (*sets)[32]; //256 bit byte sets
+	int num_sets;
+	unsigned char bclass[256]; //bytes that no set tells apart share a class
+	unsigned char class_byte[256]; //a byte of each class
+	int num_classes;
+	char literal[REGEX_LITERAL_MAX]; //longest plain text every match holds, rows without it are skipped
+	int literal_len;
+	int literal_only; //the pattern is the literal and nothing else, the kernel alone finds it
+	int refs; //workers using it, guarded by SE.lock
+} regexProg;
+
+typedef struct regexParser {
+	const char* p;
+	int icase;
+	regexAst* nodes;
+	int num_nodes;
+	int cap;
+	regexProg* prog;
+	const char* error;
+} regexParser;
+
+#define RE_STATE_MATCH (1<<0) //a match ends before the next byte
+#define RE_STATE_EOL_MATCH (1<<1) //a match ends here if this is the row end
+#define RE_STATE_DEAD (1<<2) //no match can follow
+
+/* DFA over one of the NFAs, states are made the first time a transition
+ * leads to them. Each is the set of NFA nodes a scan can be in, kept sorted
+ * in pool; when REGEX_DFA_STATES are made the cache is dropped and rebuilt
+ * from the state the scan is in, so memory stays bounded and time linear.
+ * Scans name a state by its offset in trans, state * num_classes, which
+ * keeps the multiply out of the byte loop */
+typedef struct regexDFA {
+	regexProg* prog;
+	regexNFA* nfa;
+	int anchored;
+	int num_states;
+	int cap;
+	int start[2]; //offsets for a scan beginning mid row and at the row start, -1 until made
+	int* trans; //num_classes offsets per state, -1 until followed once
+	unsigned char* flags; //at the offset of each state
+	unsigned char* bol; //state is a row start one, which passes RE_BOL nodes
+	int* set_at; //offset of the state's nodes in pool
+	int* set_len;
+	int* pool;
+	int pool_len;
+	int pool_cap;
+	int* table; //open addressing hash of node sets, 2 * REGEX_DFA_STATES slots
+	int accel; //offset of the unanchored start state when it can be skipped through, -1 if not, -2 until known
+	unsigned char stay[256]; //bytes that leave the accel state where it is
+	unsigned int* mark; //per NFA node, visited during the current closure
+	unsigned int mark_gen;
+	int* stack;
+	int* list;
+} regexDFA;
+
+/* threads of the tagged forward pass, at most one per NFA node, kept in the
+ * order of the starts they came from */
+typedef struct regexThreads {
+	int* node;
+	int* tag; //row position the thread's match began at
+	int len;
+} regexThreads;
+
+/* the passes a search worker runs a regex with, kept across ranges of the
+ * same query */
+typedef struct regexCache {
+	unsigned int generation;
+	regexDFA rev; //unanchored over the reversed pattern, marks where matches start
+	regexDFA longest; //anchored, finds where the longest match from a start ends
+	unsigned char* starts;
+	int starts_cap;
+	regexThreads threads[2]; //for rows the anchored pass would go quadratic on
+	unsigned int* mark; //per NFA node, taken during the current step
+	unsigned int mark_gen;
+	int* stack;
+	int* ends; //per row position, end of the longest match from it so far
+	int ends_cap;
+} regexCache;
+
+typedef struct searchMatch {
+	int row;
+	int cx; //index into the row text
+	int len;
+} searchMatch;
+
+typedef struct searchRange {
+	int done;
+	int count;
+	int cap;
+	searchMatch* matches;
+} searchRange;
+
+/* background search: the rows are split into ranges that a pool of workers
+ * scans while the prompt stays responsive. The buffer cannot change while
+ * the search prompt is open, so workers read rows without locking; the lock
+ * guards the hand out of ranges and their results */
+struct searchEngine {
+	pthread_mutex_t lock;
+	pthread_cond_t wake; //workers wait here for ranges
+	pthread_cond_t idle; //a worker left a range
+	int num_workers; //0 until the pool is started
+	int busy; //workers inside a range
+	unsigned int generation; //bumped per query, workers drop ranges of older ones
+	char* query;
+	int qlen;
+	int icase;
+	regexProg* regex; //compiled query in regex mode
+	const char* regex_error; //why the query did not compile
+	int numrows;
+	searchRange* ranges;
+	int num_ranges;
+	int next_range; //next range to hand out
+	int done_ranges;
+	int* finished; //indices of the done ranges, in the order they were done
+	int growing; //the file is still loading, ranges are added as rows come in
+	int paused; //rows are waiting to be appended, no range is handed out
+
+	/* owned by the main thread */
+	int active; //the search prompt is open
+	int merged; //entries of finished that are in matches
+	int prefix; //leading ranges that are in matches
+	searchMatch* matches; //all matches found so far, sorted
+	int num_matches;
+	int matches_cap;
+	int selected; //a match is selected, sel_row and sel_cx hold it
+	int sel_row;
+	int sel_cx;
+	int jump; //select the first match in the file once it is known
+	int pending; //key that acts on that match, held back until it is selected
+};
+
+struct searchEngine SE;
+
+/* a stretch of the file as a save snapshot sees it: text that is written
+ * as it is, followed by a line break unless the text already ends in one */
+typedef struct savePiece {
+	const char* text;
+	size_t len;
+	int newline;
+} savePiece;
+
+/* memory the writer may still read, from is the slab it goes back to or
+ * NULL if it was malloc'd */
+typedef struct saveOrphan {
+	void* p;
+	slab* from;
+} saveOrphan;
+
+typedef struct saveBatch {
+	struct iovec iov[SAVE_IOV_BATCH];
+	int cnt;
+	size_t bytes;
+} saveBatch;
+
+/* background save: Ctrl-S turns the rows into a list of pieces that point
+ * at their text, which takes one walk and no copying since untouched rows
+ * back to back in the map make up a single piece. A writer thread streams
+ * the pieces into a temp file while editing goes on. Rows whose own text
+ * the pieces point at are marked ROW_SHARED and copy it before a change,
+ * and texts let go of meanwhile wait in orphans until the writer is done */
+struct saveJob {
+	pthread_t thread;
+	int active; //a writer was started and has not been reaped yet
+	int done; //set by the writer when it finishes
+	int error; //errno of the step that failed, 0 on success
+	savePiece* pieces;
+	int num_pieces;
+	int pieces_cap;
+	size_t total; //bytes the file will have
+	size_t written; //bytes written so far, read by the main thread
+	size_t reported; //written at the last progress report
+	int dirty; //E.dirty when the snapshot was taken
+	size_t journal_mark; //J.logged when the snapshot was taken
+	int thread_started; //the writer runs on its own thread, else it already ran inline
+	char* path; //file the temp file replaces
+	char* tmp;
+	int fd;
+	struct timespec start;
+	struct timespec end; //when the writer finished
+	saveOrphan* orphans; //row texts, or whole erows holding their text
+	int num_orphans;
+	int orphans_cap;
+	char* rebase; //mapping of the saved file, kept until the search workers leave the rows
+	size_t rebase_size;
+};
+
+struct saveJob SV;
+
+/* a line of the file as the reader found it */
+typedef struct loadRow {
+	size_t src;
+	int len;
+} loadRow;
+
+/* progressive open: a reader thread finds the line breaks in the mapped
+ * file and hands rows over in batches, which the event loop appends to
+ * the tree between keys, so the first screen is up before the file is
+ * split. Edits only move rows that are in already and the rest of the
+ * file follows them whatever they do; what needs the whole file (saving,
+ * searching, replaying the journal) waits for the load to finish */
+struct fileLoad {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t ready; //the reader handed over a batch or finished
+	pthread_cond_t room; //the main thread took a batch
+	int active; //a reader was started and has not been reaped yet
+	loadRow* batches[LOAD_QUEUE]; //a ring, batch k lives in slot k % LOAD_QUEUE
+	int counts[LOAD_QUEUE];
+	int handed; //batches the reader handed over
+	int taken; //batches the main thread appended
+	int done; //the reader got to the end of the file
+	size_t scanned; //bytes of the file split so far
+	int reported; //percent shown by the last progress report
+	struct timespec start;
+};
+
+struct fileLoad LD;
+
+/* the row operations every edit is made of, as the journal and the undo
+ * history record them */
+enum editOp {
+	EDIT_INSERT_ROW = 1, //row, text
+	EDIT_DELETE_ROW, //row
+	EDIT_SPLICE //row, col, bytes deleted, text inserted
+};
+
+/* crash recovery journal: every row operation is appended as a record to a
+ * file next to the document, so what is lost with the terminal is at most
+ * the last JOURNAL_SYNC_MS of typing. A record is the varint length of its
+ * payload, the payload (op, varint fields, text) and an FNV-1a hash of it,
+ * a torn or garbled tail is found by the hash and dropped on replay.
+ * Saving starts the journal over with the edits made after the snapshot */
+struct editorJournal {
+	int fd; //-1 while no journal is kept
+	char* path;
+	int replaying; //edits come from the journal and are not logged again
+	char* pending; //records not written yet
+	size_t pending_len;
+	size_t pending_cap;
+	size_t logged; //record bytes after the header, written or pending
+	int unsynced; //records were written since the last fdatasync
+	struct timespec oldest; //when the oldest record not synced yet was made
+};
+
+struct editorJournal J;
+
+typedef struct undoRec {
+	unsigned char op;
+	int group; //records made by one command share it and are undone as one step
+	int row;
+	int col;
+	int del; //bytes removed, kept first at at
+	int len; //bytes inserted, kept after them
+	size_t at; //offset of the bytes in U.bytes
+} undoRec;
+
+/* undo history. Records of the row operations sit in a ring, oldest first,
+ * and the bytes they removed and inserted in a byte ring next to it, so a
+ * step costs the size of the change and rows are never copied. Typing and
+ * deleting along a row extend the last record instead of adding one. When
+ * the CTRLC_UNDO_MEM budget is used up the oldest steps are dropped */
+struct undoLog {
+	undoRec* recs;
+	int head; //slot of the oldest record
+	int count;
+	int cap;
+	int cur; //records before it are undone by Ctrl-Z, from it on redone by Ctrl-Y
+	char* bytes;
+	size_t bstart; //offset of the oldest record's bytes
+	size_t bend; //end of the newest record's bytes, bend < bstart once they wrapped
+	int group; //group of the next record
+	int sealed; //a new command began, its first record opens a new group
+	int can_merge; //the last record may be extended by typing that continues it
+	int lost_group; //group too large to be kept, its records are not recorded
+	int applying; //edits come from undo or redo and are not recorded
+};
+
+struct undoLog U;
+
 /* filetypes */
-char* C_HL_extensions[] = { ".c", ".h", ".cpp", NULL };
+char* C_HL_extensions[] = { ".c", ".h", NULL };
 char* C_HL_keywords[] = {
 	"switch", "if", "while", "for", "break", "continue", "return", "else",
 	"struct", "union", "typedef", "static", "enum", "class", "case",
@@ -103,6 +703,58 @@ char* C_HL_keywords[] = {
 	"void|", NULL
 };
 
+char* CPP_HL_extensions[] = { ".cpp", ".cc", ".cxx", ".hpp", ".hh", ".hxx", NULL };
+char* CPP_HL_keywords[] = {
+	"switch", "if", "while", "for", "do", "break", "continue", "return", "else",
+	"goto", "case", "default", "struct", "union", "typedef", "static", "enum",
+	"class", "public", "private", "protected", "virtual", "override", "final",
+	"friend", "namespace", "using", "template", "typename", "new", "delete",
+	"try", "catch", "throw", "noexcept", "operator", "this", "explicit",
+	"inline", "extern", "mutable", "constexpr", "consteval", "constinit",
+	"static_assert", "static_cast", "dynamic_cast", "const_cast",
+	"reinterpret_cast", "sizeof", "alignof", "alignas", "decltype", "typeid",
+	"co_await", "co_yield", "co_return", "concept", "requires", "export",
+	"import", "module", "thread_local", "volatile", "register", "true",
+	"false", "nullptr",
+
+	"#define", "#include", "#if", "#ifdef", "#ifndef", "#endif", "#else",
+	"#elif", "#pragma", "#undef",
+
+	"int|", "long|", "short|", "double|", "float|", "char|", "unsigned|",
+	"signed|", "void|", "bool|", "auto|", "const|", "wchar_t|", "char8_t|",
+	"char16_t|", "char32_t|", "size_t|", "std|", "string|", "vector|", NULL
+};
+
+char* RUST_HL_extensions[] = { ".rs", NULL };
+char* RUST_HL_keywords[] = {
+	"as", "async", "await", "break", "const", "continue", "crate", "dyn",
+	"else", "enum", "extern", "false", "fn", "for", "if", "impl", "in",
+	"let", "loop", "match", "mod", "move", "mut", "pub", "ref", "return",
+	"self", "Self", "static", "struct", "super", "trait", "true", "type",
+	"union", "unsafe", "use", "where", "while", "abstract", "become", "box",
+	"do", "final", "macro", "override", "priv", "try", "typeof", "unsized",
+	"virtual", "yield",
+
+	"i8|", "i16|", "i32|", "i64|", "i128|", "isize|", "u8|", "u16|", "u32|",
+	"u64|", "u128|", "usize|", "f32|", "f64|", "bool|", "char|", "str|",
+	"String|", "Vec|", "Option|", "Result|", "Box|", "Some|", "None|",
+	"Ok|", "Err|", NULL
+};
+
+char* GO_HL_extensions[] = { ".go", NULL };
+char* GO_HL_keywords[] = {
+	"break", "case", "chan", "const", "continue", "default", "defer", "else",
+	"fallthrough", "for", "func", "go", "goto", "if", "import", "interface",
+	"map", "package", "range", "return", "select", "struct", "switch", "type",
+	"var", "true", "false", "iota", "nil", "append", "cap", "close", "copy",
+	"delete", "len", "make", "new", "panic", "print", "println", "recover",
+
+	"bool|", "byte|", "complex64|", "complex128|", "error|", "float32|",
+	"float64|", "int|", "int8|", "int16|", "int32|", "int64|", "rune|",
+	"string|", "uint|", "uint8|", "uint16|", "uint32|", "uint64|",
+	"uintptr|", "any|", NULL
+};
+
 struct editorSyntax HLDB[] = {
 	{
 		"C",
@@ -111,7 +763,42 @@ struct editorSyntax HLDB[] = {
 		"//",
 		"/*",
 		"*/",
-		HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS
+		"\"'",
+		HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS,
+		NULL
+	},
+	{
+		"C++",
+		CPP_HL_extensions,
+		CPP_HL_keywords,
+		"//",
+		"/*",
+		"*/",
+		"\"'",
+		HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS,
+		NULL
+	},
+	{
+		"Rust",
+		RUST_HL_extensions,
+		RUST_HL_keywords,
+		"//",
+		"/*",
+		"*/",
+		"\"'",
+		HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS | HL_CHAR_LITERALS,
+		NULL
+	},
+	{
+		"Go",
+		GO_HL_extensions,
+		GO_HL_keywords,
+		"//",
+		"/*",
+		"*/",
+		"\"'`",
+		HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS,
+		NULL
 	},
 };
 
@@ -121,105 +808,347 @@ struct editorSyntax HLDB[] = {
 void disableRawMode();
 void enableRawMode();
 void quit_error(const char*); // program dies with error
+int editorInputFill();
+int editorInputByte(char*);
 int editorReadKey();
 int getCursorPosition(int*, int*);
 int getWindowSize(int*, int*);
+int getSyncOutputSupport();
 
 /* syntax highlighting func declarations */
+unsigned char separators[256]; //filled by editorSyntaxCompile, nonzero for separator bytes
 int is_separator(int c) {
-	return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
+	return separators[(unsigned char)c];
 }
+unsigned int editorKeywordHash(const char*, int, unsigned int);
+void editorSyntaxCompile(struct editorSyntax*);
+keywordSlot* editorSyntaxKeyword(const char*, int);
+int editorSyntaxLex(const char*, int, unsigned char*, int);
+int editorSyntaxLexSpan(const char*, int, int, unsigned char*, lexState*);
+int editorSyntaxQuote(const char*, int, int);
+int editorSyntaxRelex(erow*, int);
+int editorSyntaxSettled();
+int editorSyntaxSettle(int, int);
+void editorSyntaxDirty(int);
+void editorSyntaxRowInserted(int);
+void editorSyntaxRowDeleted(int);
 void editorUpdateSyntax(erow*);
+int editorSyntaxWorkers();
+void editorSyntaxChunk(hlChunk*);
+void* editorSyntaxWorker(void*);
+int editorSyntaxSettleParallel(int, int);
 int editorSyntaxToColor(int);
 void editorSelectSyntaxHighlight();
 
+/* row storage func declarations */
+void* slabAlloc(slab*);
+void slabFree(slab*, void*);
+void slabRelease(slab*);
+char* editorTextAlloc(size_t, unsigned char*);
+slab* editorTextSlab(erow*);
+void editorFreeRows();
+void editorShowRowStats();
+
+/* row tree func declarations */
+rownode* rtNewNode(int);
+void rtAdopt(rownode*, int);
+int rtChildPos(rownode*);
+void rtSplit(rownode*, int);
+void rtInsert(int, erow*);
+void rtRemove(erow*);
+void rtRebalance(rownode*);
+void rtFree(rownode*);
+erow* editorRowAt(int);
+int editorRowIndex(erow*);
+erow* editorRowNext(erow*);
+erow* editorRowPrev(erow*);
+
 /* row operations func declarations */
 void editorInsertRow(int, char*, size_t);
-void editorUpdateRow(erow*);
+int editorRenderText(char*, const char*, int);
+void editorUpdateRow(erow*, int, int, int);
+void editorInsertMappedRow(int, size_t, size_t);
+void editorRowMaterialize(erow*);
+void editorRowDropChars(erow*);
+void editorRowReserve(erow*, size_t);
+char* editorRowText(erow*);
+void editorRowPrepare(erow*, int);
+void editorRowDropCache(erow*);
+void editorTrimRowCache();
+void editorInvalidateRowCache();
 int editorRowCxToRx(erow*, int);
 void editorRowInsertChar(erow*, int, int);
 void editorRowDelChar(erow*, int);
 void editorFreeRow(erow*);
 void editorDelRow(int at);
 void editorRowAppendString(erow*, char*, size_t);
+void editorRowSplice(erow*, int, int, const char*, int);
 int editorRowRxToCx(erow*, int);
+int editorRenderWidth(const char*, int, int);
+int editorRenderSeek(const char*, int, int*, int);
+int editorRowParts(erow*, const char**, const char**);
+const char* editorRowBytes(erow*, int, int);
+void editorGapOpen(erow*, int, int);
+void editorGapClose();
+rowLex* editorRowLex(erow*);
+void editorRowEdited(erow*, int, int, int);
+int editorRowLexUpdate(erow*, int);
+int editorColsEnd(colBlock*);
+void editorColsScan(erow*, int, int, colBlock*);
+void editorColsBuild(erow*);
+int editorColsFind(erow*, int, int);
+void editorColsSplice(erow*, int, int, int, int);
+void editorRowPrepareLong(erow*, int);
+void editorRowCacheFill(erow*, char*, int, int, const unsigned char*);
+int editorCacheSpanAt(rowCache*, int);
 
 
 /* editor operations func declarations */
 void editorInsertChar(int);
 void editorDelChar();
 void editorInsertNewline();
+void editorInsertText(const char*, size_t);
+void editorPaste();
+int editorTypeAhead(int);
 
 /* file input/ouput func declarations */
 void editorOpen(char*);
-char* editorRowsToString(int*);
+size_t editorLoadSplit(size_t, loadRow*, int*);
+void* editorLoadReader(void*);
+int editorLoadTake(int);
+int editorLoadPoll(int);
+int editorWritev(int, struct iovec*, int);
+int editorPwrite(int, const char*, size_t, size_t);
+int editorSaveFlush(int, saveBatch*);
+int editorSaveQueue(int, saveBatch*, const char*, size_t);
+void editorSaveSnapshot();
+int editorSaveTemp(const char*);
+void* editorSaveWriter(void*);
+int editorSavePieceMoved(savePiece*, size_t);
+int editorSaveMoved(int, char*);
+int editorSaveCopy(int, char*, size_t*, size_t*, const char*, size_t, size_t);
+int editorSaveStayed(int, char*);
+int editorSaveInPlace(const char*, size_t*);
+void editorSaveReport(size_t, struct timespec*, struct timespec*);
+void editorSaveOrphan(void*, slab*);
+int editorSavePoll(int);
+void editorRebaseRows(char*, size_t, int);
+void editorSaveRebase();
 void editorSave();
 
+/* undo func declarations */
+void editorEditRecord(int, int, int, const char*, int, const char*, int);
+undoRec* undoAt(int);
+void undoDropOldest();
+void undoTruncate(int);
+int undoAlloc(size_t, size_t*);
+int undoMerge(int, int, int, const char*, int, const char*, int);
+void editorUndoRecord(int, int, int, const char*, int, const char*, int);
+void editorUndoBoundary();
+void editorUndoApply(undoRec*, int);
+void editorUndo();
+void editorRedo();
+
+/* journal func declarations */
+char* editorJournalPath(const char*);
+int journalPutVarint(unsigned char*, size_t);
+int journalGetVarint(const unsigned char*, const unsigned char*, size_t*);
+unsigned int journalHash(unsigned int, const void*, size_t);
+void editorJournalRecord(int, int, int, int, const char*, int);
+void editorJournalFlush(int);
+void editorJournalClose();
+void editorJournalStart(const char*, size_t);
+size_t editorJournalReplay(const unsigned char*, size_t);
+void editorJournalOpen();
+void editorJournalRebase(size_t);
+void editorJournalRemove();
+
+/* search kernel func declarations */
+typedef const char* (*searchKernel)(const char*, size_t, const char*, size_t, int);
+int searchEqual(const char*, const char*, size_t, int);
+const char* searchScalar(const char*, size_t, const char*, size_t, int);
+#ifdef CTRLC_SIMD_X86
+const char* searchSSE2(const char*, size_t, const char*, size_t, int);
+const char* searchAVX2(const char*, size_t, const char*, size_t, int);
+#endif
+searchKernel editorSearchKernel();
+
+/* regex func declarations */
+int regexAstNew(regexParser*, int);
+int regexSetNew(regexParser*);
+void regexSetFold(unsigned char*);
+int regexParseAlt(regexParser*);
+int regexParseCat(regexParser*);
+int regexParseRepeat(regexParser*);
+int regexParseCount(regexParser*, int*, int*);
+int regexParseAtom(regexParser*);
+int regexParseEscape(regexParser*, unsigned char*);
+int regexParseClass(regexParser*);
+long regexAstSize(regexAst*, int);
+int regexNodeNew(regexNFA*, int, int, int, int);
+int regexEmit(regexNFA*, regexAst*, int, int, int);
+void regexBuildNFA(regexNFA*, regexAst*, int, int, int);
+void regexFindLiteral(regexProg*, regexAst*, int);
+regexProg* regexCompile(const char*, int, const char**);
+void regexFree(regexProg*);
+void regexDFAInit(regexDFA*, regexProg*, regexNFA*, int);
+void regexDFAFree(regexDFA*);
+void regexNewMark(regexDFA*);
+void regexClosure(regexDFA*, int, int, int*);
+int regexEndMatch(regexDFA*, int*, int, int);
+int regexCompareInt(const void*, const void*);
+int regexState(regexDFA*, int*, int, int);
+int regexStart(regexDFA*, int);
+int regexStep(regexDFA*, int, int);
+void regexAccel(regexDFA*);
+int regexMarkStarts(regexDFA*, const char*, int, unsigned char*);
+int regexLongestEnd(regexDFA*, const char*, int, int, int*);
+void regexAddThread(regexCache*, regexThreads*, int, int, int, int);
+void regexLongestPass(regexCache*, const char*, int, int, int, searchRange*);
+void regexCacheReset(regexCache*, regexProg*, unsigned int);
+void regexCacheFree(regexCache*);
+
+/* search engine func declarations */
+void editorSearchAdd(searchRange*, int, int, int);
+void editorSearchRegexRow(regexCache*, const char*, int, int, searchRange*);
+int editorSearchRows(int, int, const char*, int, int, regexCache*, unsigned int, searchRange*);
+void* editorSearchWorker(void*);
+void editorSearchStart(const char*);
+void editorSearchStop();
+int editorSearchPause(int);
+void editorSearchResume();
+int editorSearchPoll();
+void editorSearchMerge(searchRange*, int);
+void editorSearchKey(int);
+void editorSearchWaitAll();
+int editorSearchLowerBound(int, int);
+void editorSearchSelect(int);
+
 /* find func declarations */
 void editorFind();
 void editorFindCallback(char*, int);
 
+/* replace func declarations */
+void editorReplaceRow(erow*, searchMatch*, int, const char*, int);
+int editorReplaceMatches(searchMatch*, int, const char*);
+void editorReplaceCallback(char*, int);
+void editorReplace();
+
 /* input func declarations */
 void editorMoveCursor(int);
 void editorProcessKeypress();
-char* editorPrompt(char*, void (*callback)(char*, int));
+char* editorPrompt(char*, void (*callback)(char*, int), int);
 
 /* init func declarations */
 void initEditor();
 
+/* event loop func declarations */
+void editorEventInit();
+void editorEventWake();
+void editorEventSigWinCh(int);
+int editorEventReady();
+int editorEventKeyReady();
+int editorEventTimeout();
+void editorEventWait();
+
 /* append buffer, lets make dynamic string type */
 struct abuf {
 	char* b;
 	int len;
+	int cap; //grows by doubling, so a buffer that is reused stops reallocating
 };
 
-#define ABUF_INIT {NULL, 0}
+#define ABUF_INIT {NULL, 0, 0}
 
 /* append buffer functions declaration */
+char* abReserve(struct abuf*, int);
 void abAppend(struct abuf*, const char*, int len);
+void abAppendCells(struct abuf*, const cell*, int);
 void abFree(struct abuf*);
 
+/* SGR escape for every cell attr, built once by editorFrameInitAttrs */
+char attr_escape[256][16];
+int attr_escape_len[256];
+
 /* output func declaration */
 void editorScroll();
+void editorFrameInitAttrs();
+void editorFrameResize();
+void editorFramePut(int, int, const char*, int, unsigned char);
+void editorFrameAttr(struct abuf*, unsigned char);
+void editorFrameFlush(struct abuf*);
 void editorRefreshScreen();
-void editorDrawRows(struct abuf*);
-void editorDrawStatusBar(struct abuf*);
+void editorDrawRows();
+void editorDrawStatusBar();
 void editorSetStatusMessage(const char*, ...);
-void editorDrawMessageBar(struct abuf* ab);
+void editorDrawMessageBar();
+void editorShowFrameStats();
 
 int main(int argc, char* argv[]) {
 	enableRawMode();
 	initEditor();
+	editorEventInit();
+	editorSetStatusMessage(
+			"HELP: Ctrl+Q = quit | Ctrl+S = save | Ctrl+F = find");
 	if (argc >= 2) {
 		editorOpen(argv[1]);
 	}
+	EV.redraw = 1; //the journal prompt may have drawn a frame that is now stale
 
-	editorSetStatusMessage(
-			"HELP: Ctrl+Q = quit | Ctrl+S = save | Ctrl+F = find");
-
+	/* frames are drawn by editorEventWait once the queued input is used up,
+	 * so a burst of keys costs one frame rather than one per key. The view
+	 * still follows the cursor after every key, paging depends on it */
 	while (1) {
-		editorRefreshScreen();
 		editorProcessKeypress();
+		editorScroll();
+		EV.redraw = 1;
 	}
 
 	return EXIT_SUCCESS;
 }
 
 /* append buffer functions realization */
-void abAppend(struct abuf* ab, const char* s, int len) {
-	char* new = realloc(ab->b, ab->len + len);
-	if (new == NULL) {
-		fprintf(stderr, "\nMemory allocation error in abAppend!\n");
-		return;
+/* makes room for len more bytes and returns where they go */
+char* abReserve(struct abuf* ab, int len) {
+	if (ab->len + len > ab->cap) {
+		int cap = ab->cap ? ab->cap : ABUF_MIN_CAP;
+		while (cap < ab->len + len) cap *= 2;
+
+		char* new = realloc(ab->b, cap);
+		if (new == NULL) {
+			fprintf(stderr, "\nMemory allocation error in abAppend!\n");
+			return NULL;
+		}
+		ab->b = new;
+		ab->cap = cap;
 	}
 
-	memcpy(&new[ab->len], s, len);
-	ab->b = new;
+	return &ab->b[ab->len];
+}
+
+void abAppend(struct abuf* ab, const char* s, int len) {
+	char* dst = abReserve(ab, len);
+	if (dst == NULL) return;
+
+	memcpy(dst, s, len);
+	ab->len += len;
+}
+
+/* appends the characters of a run of cells */
+void abAppendCells(struct abuf* ab, const cell* c, int len) {
+	char* dst = abReserve(ab, len);
+	if (dst == NULL) return;
+
+	for (int i = 0; i < len; ++i) {
+		dst[i] = c[i].ch;
+	}
 	ab->len += len;
 }
 
 void abFree(struct abuf* ab) {
 	free(ab->b);
+	ab->b = NULL;
+	ab->len = ab->cap = 0;
 }
 
 /* init functions realization */
@@ -228,7 +1157,17 @@ void initEditor() {
 	E.cursor_y = 0;
 	E.render_x = 0;
 	E.numrows = 0;
-	E.row = NULL;
+	E.rowtree = rtNewNode(1);
+	E.map = NULL;
+	E.map_size = 0;
+	E.map_heap = 0;
+	E.hl_frontier = 0;
+	E.hl_pending = -1;
+	E.hl_dirty_end = -1;
+	E.hl_provisional = 0;
+	E.cached_rows = NULL;
+	E.num_cached = 0;
+	E.cached_cap = 0;
 	E.filename = NULL;
 	E.rowoffset = 0;
 	E.coloffset = 0;
@@ -236,6 +1175,24 @@ void initEditor() {
 	E.statusmsg_time = 0;
 	E.dirty = 0;
 	E.syntax = NULL;
+	E.frame = NULL;
+	E.shown = NULL;
+	E.frame_rows = 0;
+	E.frame_cols = 0;
+	E.repaint = 1;
+	E.shown_rowoffset = 0;
+	E.frames = 0;
+	E.frame_us_last = 0;
+	E.frame_us_max = 0;
+	E.frame_us_total = 0;
+	E.frame_bytes_last = 0;
+	E.search_icase = 0;
+	E.search_regex = 0;
+	E.hl_batch = 0;
+	EV.redraw = 1;
+	J.fd = -1;
+	U.lost_group = -1;
+	editorFrameInitAttrs();
 
 	if (getWindowSize(&E.screenrows, &E.screencols) == -1) {
 		quit_error("getWindowSize error in initEditor");
@@ -243,6 +1200,140 @@ void initEditor() {
 	E.screencols -= LINENUM_MARGIN;
 
 	E.screenrows -= 2;
+
+	E.sync_output = getSyncOutputSupport();
+}
+
+/* event loop functions realization */
+void editorEventInit() {
+	if (pipe(EV.wake) == -1) {
+		quit_error("pipe error in editorEventInit");
+	}
+	for (int i = 0; i < 2; ++i) {
+		fcntl(EV.wake[i], F_SETFL, fcntl(EV.wake[i], F_GETFL) | O_NONBLOCK);
+		fcntl(EV.wake[i], F_SETFD, FD_CLOEXEC);
+	}
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = editorEventSigWinCh;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGWINCH, &sa, NULL);
+}
+
+/* safe from signal handlers and other threads; a full pipe already means
+ * the loop is about to wake */
+void editorEventWake() {
+	int saved = errno;
+	ssize_t n = write(EV.wake[1], "", 1);
+	(void)n;
+	errno = saved;
+}
+
+void editorEventSigWinCh(int sig) {
+	(void)sig;
+	EV.resized = 1;
+	editorEventWake();
+}
+
+/* whether a key or a wake up is waiting, without blocking */
+int editorEventReady() {
+	struct pollfd pfd[2] = { { STDIN_FILENO, POLLIN, 0 }, { EV.wake[0], POLLIN, 0 } };
+
+	return IN.head != IN.tail || poll(pfd, 2, 0) > 0;
+}
+
+/* like editorEventReady, but wake ups of the worker threads do not count */
+int editorEventKeyReady() {
+	struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+
+	return IN.head != IN.tail || poll(&pfd, 1, 0) > 0;
+}
+
+/* milliseconds until the next timer is due: the status message running
+ * out, or journal records waiting to be synced. -1 if nothing is pending */
+int editorEventTimeout() {
+	long timeout = -1;
+
+	if (E.statusmsg[0]) {
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		timeout = (E.statusmsg_time + STATUSMSG_SECONDS - now.tv_sec) * 1000 - now.tv_nsec / 1000000;
+		if (timeout < 0) timeout = 0;
+	}
+
+	if (J.fd != -1 && J.unsynced) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		long ms = JOURNAL_SYNC_MS - ((now.tv_sec - J.oldest.tv_sec) * 1000 +
+				(now.tv_nsec - J.oldest.tv_nsec) / 1000000);
+		if (ms < 0) ms = 0;
+		if (timeout == -1 || ms < timeout) timeout = ms;
+	}
+
+	return timeout;
+}
+
+/* the event loop, run whenever a key is wanted and none is queued, or while
+ * queued keys are held back for a search key waiting on its match: it
+ * handles whatever woke it, settles highlighting in slices that give way
+ * to input, draws a frame only if something changed, then sleeps until a
+ * key, a wake up or the next timer */
+void editorEventWait() {
+	while (IN.head == IN.tail || SE.pending) {
+		if (EV.resized) {
+			EV.resized = 0;
+			EV.redraw = 1; //editorFrameResize picks up the new size
+		}
+		if (editorSearchPoll() | editorSavePoll(0) | editorLoadPoll(0)) {
+			EV.redraw = 1;
+		}
+		editorJournalFlush(0);
+		if (E.statusmsg[0] && time(NULL) - E.statusmsg_time >= STATUSMSG_SECONDS) {
+			E.statusmsg[0] = '\0';
+			EV.redraw = 1;
+		}
+		if (EV.redraw) {
+			editorRefreshScreen();
+		}
+
+		if (IN.head != IN.tail) {
+			if (SE.pending == 0) break; //the held back keys were let go
+		}
+		else if (!SE.paused) {
+			/* a file that was just opened is lexed on every core at once,
+			 * slices settle what is left and whatever was edited since. Rows
+			 * drawn before their comment state was known are drawn again
+			 * once the lexing reaches them. Held back keys leave the cores
+			 * to the search they wait on, and so do rows waiting for the
+			 * search workers to leave the tree */
+			if (E.syntax && E.hl_pending == -1 && E.numrows - E.hl_frontier >= 2 * HL_CHUNK_ROWS &&
+					editorSyntaxWorkers() > 1) {
+				editorSyntaxSettleParallel(editorSyntaxWorkers(), 1);
+			}
+			while (!editorSyntaxSettle(E.numrows - 1, HL_IDLE_SLICE)) {
+				if (editorEventReady()) break;
+			}
+			int settled = editorSyntaxSettled();
+			if (E.hl_provisional && (settled >= E.numrows || settled >= E.rowoffset + E.screenrows)) {
+				editorRefreshScreen();
+			}
+		}
+
+		/* stdin is left alone while held back keys fill the ring */
+		int full = IN.tail - IN.head == INPUT_RING;
+		struct pollfd pfd[2] = { { full ? -1 : STDIN_FILENO, POLLIN, 0 }, { EV.wake[0], POLLIN, 0 } };
+		if (poll(pfd, 2, editorEventTimeout()) <= 0) continue;
+
+		if (pfd[1].revents & POLLIN) {
+			char drain[64];
+			while (read(EV.wake[0], drain, sizeof(drain)) > 0);
+		}
+		if (pfd[0].revents & POLLIN) {
+			editorInputFill();
+		}
+	}
 }
 
 /* terminal functions realization */
@@ -255,6 +1346,7 @@ void quit_error(const char* s) {
 }
 
 void disableRawMode() {
+	write(STDOUT_FILENO, "\x1b[?2004l", 8);
 	if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1) {
 		quit_error("disableRawMode error");
 	}
@@ -280,38 +1372,72 @@ void enableRawMode() {
 	if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) {
 		quit_error("enableRawMode; tcsetattr error");
 	}
+
+	/* pastes come wrapped in ESC [200~ and ESC [201~ */
+	write(STDOUT_FILENO, "\x1b[?2004h", 8);
+}
+
+/* reads what the terminal has into the ring, waiting up to one VTIME
+ * tick when it has nothing; returns the bytes read */
+int editorInputFill() {
+	unsigned int used = IN.tail - IN.head;
+	unsigned int at = IN.tail & (INPUT_RING - 1);
+	unsigned int room = INPUT_RING - used;
+	if (room > INPUT_RING - at) {
+		room = INPUT_RING - at;
+	}
+	if (room == 0) return 0;
+
+	ssize_t nread = read(STDIN_FILENO, &IN.buf[at], room);
+	if (nread == -1 && errno != EAGAIN && errno != EINTR) {
+		quit_error("error in reading key");
+	}
+	if (nread <= 0) return 0;
+
+	IN.tail += nread;
+	return nread;
+}
+
+/* takes the next input byte, returns 0 if none came within a tick */
+int editorInputByte(char* c) {
+	if (IN.head == IN.tail && editorInputFill() == 0) return 0;
+
+	*c = IN.buf[IN.head++ & (INPUT_RING - 1)];
+	return 1;
 }
 
 int editorReadKey() {
-	int nread;
 	char c;
-	while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
-	//here read() waits untill user press key by reading nbytes = 1 from STDIN_FILENO
-	//read() returns number of bytes read from fd(here it is STDIN_FILENO)
-	//and if user pressed key, the loop is over and read character is returned
-		if (nread == -1 && errno != EAGAIN) {
-			quit_error("error in reading key");
-		}
-	}
+	do {
+		editorEventWait();
+	} while (!editorInputByte(&c));
 
 	if (c == '\x1b') {
-		char seq[3];
+		char seq[2];
 
-		if (read(STDIN_FILENO, &seq[0], 1) != 1) return '\x1b';
-		if (read(STDIN_FILENO, &seq[1], 1) != 1) return '\x1b';
+		if (!editorInputByte(&seq[0])) return '\x1b';
+		if (!editorInputByte(&seq[1])) return '\x1b';
 
 		if (seq[0] == '[') {
 			if (seq[1] >= '0' && seq[1] <= '9') {
-				if (read(STDIN_FILENO, &seq[2], 1) != 1) return '\x1b';
-				if (seq[2] == '~') {
-					switch (seq[1]) {
-						case '1': return HOME;
-						case '3': return DELETE;
-						case '4': return END;
-						case '5': return PAGE_UP;
-						case '6': return PAGE_DOWN;
-						case '7': return HOME;
-						case '8': return END;
+				int num = seq[1] - '0';
+				char next;
+				do {
+					if (!editorInputByte(&next)) return '\x1b';
+					if (next >= '0' && next <= '9') num = num * 10 + next - '0';
+				} while (next >= '0' && next <= '9' && num < 1000);
+
+				if (next == '~') {
+					switch (num) {
+						case 1: return HOME;
+						case 3: return DELETE;
+						case 4: return END;
+						case 5: return PAGE_UP;
+						case 6: return PAGE_DOWN;
+						case 7: return HOME;
+						case 8: return END;
+						case 200: return PASTE_START;
+						case 201: return PASTE_END;
 					}
 				}
 			}
@@ -370,6 +1496,58 @@ int getCursorPosition(int* rows, int* cols) {
 	return 0;
 }
 
+/* asks for the state of DEC mode 2026 and, right behind it, for the primary
+ * device attributes that every terminal answers; a terminal that does not
+ * know DECRQM stays silent on the first query, so the second one ends the
+ * wait either way. Keys typed meanwhile are not part of either reply and go
+ * to the input ring */
+int getSyncOutputSupport() {
+	if (write(STDOUT_FILENO, "\x1b[?2026$p\x1b[c", 12) != 12) {
+		return 0;
+	}
+
+	char seq[64]; //a reply being read, "\x1b[?" then parameters and a final byte
+	unsigned int len = 0;
+	int mode = 0;
+
+	for (int n = 0; n < 4096; ++n) {
+		char c;
+		if (read(STDIN_FILENO, &c, 1) != 1) break;
+
+		if (len == 0 && c != '\x1b') {
+			IN.buf[IN.tail++ & (INPUT_RING - 1)] = c;
+			continue;
+		}
+		seq[len++] = c;
+
+		int reply = (len < 2 || seq[1] == '[') && (len < 3 || seq[2] == '?') && len < sizeof(seq);
+		if (reply && len > 3 && !isdigit(c) && c != ';' && c != '$') {
+			/* a final byte ends the reply */
+			seq[len] = '\0';
+			if (c == 'c') {
+				len = 0;
+				break;
+			}
+			if (c == 'y' && sscanf(seq, "\x1b[?2026;%d$y", &mode) == 1) {
+				len = 0;
+				continue;
+			}
+			reply = 0;
+		}
+		if (!reply) {
+			for (unsigned int i = 0; i < len; ++i) {
+				IN.buf[IN.tail++ & (INPUT_RING - 1)] = seq[i];
+			}
+			len = 0;
+		}
+	}
+	for (unsigned int i = 0; i < len; ++i) {
+		IN.buf[IN.tail++ & (INPUT_RING - 1)] = seq[i]; //cut short by the timeout
+	}
+
+	return mode == 1 || mode == 2; //set or reset, 0 and 4 mean unknown or unavailable
+}
+
 int getWindowSize(int* rows, int* cols) {
 	struct winsize ws;
 
@@ -389,13 +1567,24 @@ int getWindowSize(int* rows, int* cols) {
 }
 
 /* syntax highlighting func realization */
-void editorUpdateSyntax(erow* row) {
-	row->hl = realloc(row->hl, row->render_size);
-	memset(row->hl, HL_NORMAL, row->render_size);
-
-	if (E.syntax == NULL) return;
+/* lexes one line of text and returns whether it ends inside a multiline
+ * comment; with hl == NULL only that state is tracked, which is enough to
+ * chain rows that were never materialized */
+int editorSyntaxLex(const char* text, int len, unsigned char* hl, int in_comment) {
+	lexState state = { in_comment, 0, 1, HL_NORMAL, 0 };
+	editorSyntaxLexSpan(text, len, len, hl, &state);
+
+	return state.in_comment;
+}
 
-	char** keywords = E.syntax->keywords;
+/* lexes text from state until it stands at or past to and returns where
+ * it stopped; bytes up to len may be looked at to finish a token. Long rows
+ * are lexed in such spans from their checkpoints */
+int editorSyntaxLexSpan(const char* text, int to, int len, unsigned char* hl, lexState* state) {
+	if (state->line_comment) {
+		if (hl) memset(hl, HL_COMMENT, to);
+		return to;
+	}
 
 	char* scs = E.syntax->signleline_comment_start; //scs stands for singleline comment start
 	char* mcs = E.syntax->multiline_comment_start;
@@ -405,27 +1594,28 @@ void editorUpdateSyntax(erow* row) {
 	int mcs_len = mcs ? strlen(mcs) : 0;
 	int mce_len = mce ? strlen(mce) : 0;
 
-	int prev_sep = 1;
-	int in_string = 0;
-	int in_comment = (row->idx > 0 && E.row[row->idx - 1].hl_open_comment);
+	int in_comment = state->in_comment;
+	int prev_sep = state->prev_sep;
+	int in_string = state->in_string;
 
 	int i = 0;
-	while (i < row->render_size) {
-		char c = row->render[i];
-		unsigned char prev_hl = (i > 0) ? row->hl[i - 1] : HL_NORMAL;
+	while (i < to) {
+		char c = text[i];
+		unsigned char prev_hl = hl ? (i > 0 ? hl[i - 1] : state->prev_hl) : HL_NORMAL;
 
 		if (scs_len && !in_string && !in_comment) {
-			if (!strncmp(&row->render[i], scs, scs_len)) {
-				memset(&row->hl[i], HL_COMMENT, row->render_size - i);
+			if (i + scs_len <= len && !strncmp(&text[i], scs, scs_len)) {
+				if (hl) memset(&hl[i], HL_COMMENT, to - i);
+				state->line_comment = 1;
+				i = to;
 				break;
 			}
 		}
-
 		if (mcs_len && mce_len && !in_string) {
 			if (in_comment) {
-				row->hl[i] = HL_MLCOMMENT;
-				if (!strncmp(&row->render[i], mce, mce_len)) {
-					memset(&row->hl[i], HL_MLCOMMENT, mce_len);
+				if (hl) hl[i] = HL_MLCOMMENT;
+				if (i + mce_len <= len && !strncmp(&text[i], mce, mce_len)) {
+					if (hl) memset(&hl[i], HL_MLCOMMENT, mce_len);
 					i += mce_len;
 					in_comment = 0;
 					prev_sep = 1;
@@ -436,8 +1626,8 @@ void editorUpdateSyntax(erow* row) {
 					continue;
 				}
 			}
-			else if (!strncmp(&row->render[i], mcs, mcs_len)) {
-				memset(&row->hl[i], HL_MLCOMMENT, mcs_len);
+			else if (i + mcs_len <= len && !strncmp(&text[i], mcs, mcs_len)) {
+				if (hl) memset(&hl[i], HL_MLCOMMENT, mcs_len);
 				i += mcs_len;
 				in_comment = 1;
 				continue;
@@ -446,10 +1636,10 @@ void editorUpdateSyntax(erow* row) {
 
 		if (E.syntax->flags & HL_HIGHLIGHT_STRINGS) {
 			if (in_string) {
-				row->hl[i] = HL_STRING;
+				if (hl) hl[i] = HL_STRING;
 
-				if (c == '\\' && i + 1 < row->render_size) {
-					row->hl[i + 1] = HL_STRING;
+				if (c == '\\' && in_string != '`' && i + 1 < len) {
+					if (hl) hl[i + 1] = HL_STRING;
 					i += 2;
 					continue;
 				}
@@ -460,19 +1650,25 @@ void editorUpdateSyntax(erow* row) {
 				continue;
 			}
 			else {
-				if (c == '"' || c == '\'') {
+				if (c && strchr(E.syntax->string_quotes, c) && editorSyntaxQuote(text, i, len)) {
 					in_string = c;
-					row->hl[i] = HL_STRING;
+					if (hl) hl[i] = HL_STRING;
 					++i;
 					continue;
 				}
 			}
 		}
 
+		if (hl == NULL) {
+			/* numbers and keywords never hide a comment or string start */
+			++i;
+			continue;
+		}
+
 		if (E.syntax->flags & HL_HIGHLIGHT_NUMBERS) {
 			if ((isdigit(c) && (prev_sep || prev_hl == HL_NUMBER)) ||
 					(c == '.' && prev_hl == HL_NUMBER)) {
-				row->hl[i] = HL_NUMBER;
+				hl[i] = HL_NUMBER;
 				++i;
 				prev_sep = 0;
 				continue;
@@ -480,22 +1676,11 @@ void editorUpdateSyntax(erow* row) {
 		}
 
 		if (prev_sep) {
-			int j;
-			for (j = 0; keywords[j]; ++j) {
-				int klen = strlen(keywords[j]);
-				int kw2 = keywords[j][klen - 1] == '|';
-
-				if (kw2) --klen;
-
-				if (!strncmp(&row->render[i], keywords[j], klen) &&
-					is_separator(row->render[i + klen])) {
-					memset(&row->hl[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
-					i += klen;
-					break;
-				}
-			}
+			keywordSlot* kw = editorSyntaxKeyword(&text[i], len - i);
 
-			if (keywords[j] != NULL) {
+			if (kw) {
+				memset(&hl[i], kw->hl, kw->len);
+				i += kw->len;
 				prev_sep = 0;
 				continue;
 			}
@@ -505,378 +1690,4830 @@ void editorUpdateSyntax(erow* row) {
 		++i;
 	}
 
-	int changed = (row->hl_open_comment != in_comment);
-	row->hl_open_comment = in_comment;
-	if (changed && row->idx + 1 < E.numrows) {
-		editorUpdateSyntax(&E.row[row->idx + 1]);
+	state->in_comment = in_comment;
+	state->in_string = in_string;
+	state->prev_sep = prev_sep;
+	if (hl && i > 0) state->prev_hl = hl[i - 1];
+
+	return i;
+}
+
+/* whether the quote at i opens a string. With HL_CHAR_LITERALS a ' has to
+ * be closed right after one character, UTF-8 sequences included, or open
+ * an escape; otherwise it is a lifetime or a label */
+int editorSyntaxQuote(const char* text, int i, int len) {
+	if (text[i] != '\'' || !(E.syntax->flags & HL_CHAR_LITERALS)) return 1;
+	if (i + 1 < len && text[i + 1] == '\\') return 1;
+
+	int j = i + 2;
+	while (j < len && ((unsigned char)text[j] & 0xc0) == 0x80) {
+		++j;
 	}
+
+	return j < len && text[j] == '\'';
 }
 
-int editorSyntaxToColor(int hl) {
-	switch (hl) {
-		case HL_COMMENT:
-		case HL_MLCOMMENT: return 36;
-		case HL_KEYWORD1: return 33;
-		case HL_KEYWORD2: return 32;
-		case HL_STRING: return 35;
-		case HL_NUMBER: return 31;
-		case HL_MATCH: return 34;
+/* FNV-1a, seeded so that editorSyntaxCompile can search for a seed under
+ * which no two keywords share a slot */
+unsigned int editorKeywordHash(const char* word, int len, unsigned int seed) {
+	unsigned int h = 2166136261u ^ seed;
 
-		default: return 37;
+	for (int i = 0; i < len; ++i) {
+		h = (h ^ (unsigned char)word[i]) * 16777619u;
 	}
+
+	return h;
 }
 
-void editorSelectSyntaxHighlight() {
-	E.syntax = NULL;
-	if (E.filename == NULL) return;
+void editorSyntaxCompile(struct editorSyntax* syntax) {
+	if (!separators[' ']) {
+		for (int c = 0; c < 256; ++c) {
+			separators[c] = isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
+		}
+	}
 
-	char* ext = strrchr(E.filename, '.');
+	keywordTable* table = calloc(1, sizeof(keywordTable));
+	if (table == NULL) {
+		quit_error("calloc error in editorSyntaxCompile");
+	}
 
-	for (unsigned int j = 0; j < HLDB_ENTRIES; ++j) {
-		struct editorSyntax* s = &HLDB[j];
-		unsigned int i = 0;
+	int count = 0;
+	while (syntax->keywords[count]) ++count;
 
-		while (s->filematch[i]) {
-			int is_ext = (s->filematch[i][0] == '.');
+	unsigned int size = 16;
+	while (size < (unsigned int)count * 2) size *= 2;
 
-			if ((is_ext && ext && !strcmp(ext, s->filematch[i])) ||
-				(!is_ext && strstr(E.filename, s->filematch[i]))) {
-				E.syntax = s;
+	/* a few hundred seeds are usually enough at half load; if none of
+	 * them works the table doubles and the search starts over */
+	for (;;) {
+		table->slots = calloc(size, sizeof(keywordSlot));
+		if (table->slots == NULL) {
+			quit_error("calloc error in editorSyntaxCompile");
+		}
+		table->mask = size - 1;
 
-				for (int filerow = 0; filerow < E.numrows; ++filerow) {
-					editorUpdateSyntax(&E.row[filerow]);
+		for (table->seed = 0; table->seed < 4096; ++table->seed) {
+			int j;
+			memset(table->slots, 0, size * sizeof(keywordSlot));
+			table->max_len = 0;
+
+			for (j = 0; j < count; ++j) {
+				char* word = syntax->keywords[j];
+				int len = strlen(word);
+				int kw2 = word[len - 1] == '|';
+				if (kw2) --len;
+
+				keywordSlot* slot = &table->slots[editorKeywordHash(word, len, table->seed) & table->mask];
+				if (slot->word) {
+					/* a repeated keyword keeps its first class, like the old linear scan */
+					if (slot->len == len && !strncmp(slot->word, word, len)) continue;
+					break;
 				}
 
+				slot->word = word;
+				slot->len = len;
+				slot->hl = kw2 ? HL_KEYWORD2 : HL_KEYWORD1;
+				if (len > table->max_len) table->max_len = len;
+			}
+
+			if (j == count) {
+				syntax->kwtable = table;
 				return;
 			}
-			++i;
 		}
-	}
-}
 
-/* row operations func realization */
-int editorRowCxToRx(erow* row, int cx) {
-	int rx = 0;
-	for (int j = 0; j < cx; ++j) {
-		if (row->chars[j] == '\t') {
-			rx += (CTRLC_TAB_STOP - 1) - (rx % CTRLC_TAB_STOP);
-		}
-		++rx;
+		free(table->slots);
+		size *= 2;
 	}
-
-	return rx;
 }
 
-int editorRowRxToCx(erow* row, int rx) {
-	int cur_rx = 0; //rx stands for render x
-	int cx; //cx stands for cursor_x
-	for (cx = 0; cx < row->size; ++cx) {
-		if (row->chars[cx] == '\t') {
-			cur_rx += (CTRLC_TAB_STOP - 1) - (cur_rx % CTRLC_TAB_STOP);
-		}
-		++cur_rx;
+/* looks up the word starting at text, which runs up to the next separator;
+ * keywords never contain separators themselves, so a word that is longer
+ * than any keyword cannot match */
+keywordSlot* editorSyntaxKeyword(const char* text, int len) {
+	keywordTable* table = E.syntax->kwtable;
+
+	int n = 0;
+	while (n < len && !separators[(unsigned char)text[n]]) {
+		if (++n > table->max_len) return NULL;
+	}
+	if (n == 0) return NULL;
 
-		if (cur_rx > rx) return cx;
+	keywordSlot* slot = &table->slots[editorKeywordHash(text, n, table->seed) & table->mask];
+	if (slot->word && slot->len == n && !memcmp(slot->word, text, n)) {
+		return slot;
 	}
 
-	return cx;
+	return NULL;
 }
 
-void editorUpdateRow(erow* row) {
-	int tabs = 0;
-	for (int i = 0; i < row->size; ++i) {
-		if (row->chars[i] == '\t') ++tabs;
-	}
+/* tabs only widen whitespace, so lexing the raw text of a row yields the
+ * same comment state as its render would, without having to build it */
+int editorSyntaxRelex(erow* row, int in_comment) {
+	if (row->lex) return editorRowLexUpdate(row, in_comment);
 
-	free(row->render);
-	row->render = malloc(row->size + tabs * (CTRLC_TAB_STOP - 1) + 1);
+	return editorSyntaxLex(editorRowText(row), row->size, NULL, in_comment);
+}
 
-	int idx = 0;
-	for (int j = 0; j < row->size; ++j) {
-		if (row->chars[j] == '\t') {
-			row->render[idx++] = ' ';
-			while (idx % CTRLC_TAB_STOP != 0) {
-				row->render[idx++] = ' ';
+/* the per row hl_open_comment values act as lexer checkpoints: rows before
+ * the returned index are known to hold their true outgoing state */
+int editorSyntaxSettled() {
+	return E.hl_pending != -1 ? E.hl_pending : E.hl_frontier;
+}
+
+/* lexes forward from the first unsettled row, iteratively, until row upto is
+ * settled or about budget bytes have been lexed; stale rows stop the walk
+ * as soon as one comes out with the state it already had. Returns 1 once
+ * upto is settled */
+int editorSyntaxSettle(int upto, int budget) {
+	if (E.syntax == NULL) return 1;
+
+	int at = editorSyntaxSettled();
+	erow* row = editorRowAt(at);
+	erow* prev = row ? editorRowPrev(row) : NULL;
+	int in_comment = prev ? prev->hl_open_comment : 0;
+
+	while (row && at <= upto && budget > 0) {
+		in_comment = editorSyntaxRelex(row, in_comment);
+		budget -= row->size + 1;
+
+		if (at < E.hl_frontier) {
+			int changed = (row->hl_open_comment != in_comment);
+			row->hl_open_comment = in_comment;
+
+			if (!changed && at >= E.hl_dirty_end) {
+				/* caught up with the old states, the rest of them still hold */
+				E.hl_pending = -1;
+				at = E.hl_frontier;
+				row = editorRowAt(at);
+				prev = row ? editorRowPrev(row) : NULL;
+				in_comment = prev ? prev->hl_open_comment : 0;
+				continue;
 			}
+			E.hl_pending = (at + 1 < E.hl_frontier) ? at + 1 : -1;
 		}
 		else {
-			row->render[idx++] = row->chars[j];
+			row->hl_open_comment = in_comment;
+			++E.hl_frontier;
 		}
+
+		row = editorRowNext(row);
+		++at;
 	}
-	row->render[idx] = '\0';
-	row->render_size = idx;
 
-	editorUpdateSyntax(row);
+	return editorSyntaxSettled() > upto || editorSyntaxSettled() >= E.numrows;
 }
 
-void editorInsertRow(int at, char* string, size_t len) {
-	if (at < 0 || at > E.numrows) return;
-
-	E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1));
-	memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numrows - at));
+/* the row at index at has to be lexed again before anything below it can be
+ * trusted; rows that were never lexed need no marking */
+void editorSyntaxDirty(int at) {
+	if (at >= E.hl_frontier) return;
 
-	for (int j = at + 1; j <= E.numrows; ++j) {
-		++E.row[j].idx;
+	/* a walk that was already under way has to get past its own start too */
+	if (E.hl_pending > E.hl_dirty_end) {
+		E.hl_dirty_end = E.hl_pending;
 	}
+	if (at > E.hl_dirty_end) {
+		E.hl_dirty_end = at;
+	}
+	if (E.hl_pending == -1 || at < E.hl_pending) {
+		E.hl_pending = at;
+	}
+}
 
-	E.row[at].idx = at;
-
-	E.row[at].size = len;
-	E.row[at].chars = malloc(len + 1);
-	memcpy(E.row[at].chars, string, len);
-	E.row[at].chars[len] = '\0';
+void editorSyntaxRowInserted(int at) {
+	if (at < E.hl_frontier) ++E.hl_frontier;
+	if (E.hl_pending != -1 && at <= E.hl_pending) ++E.hl_pending;
+	if (at <= E.hl_dirty_end) ++E.hl_dirty_end;
+}
 
-	E.row[at].render_size = 0;
-	E.row[at].render = NULL;
-	E.row[at].hl = NULL;
-	E.row[at].hl_open_comment = 0;
-	editorUpdateRow(&E.row[at]);
+void editorSyntaxRowDeleted(int at) {
+	if (at < E.hl_frontier) --E.hl_frontier;
+	if (E.hl_pending > at) --E.hl_pending;
+	if (E.hl_dirty_end > at) --E.hl_dirty_end;
+	if (E.hl_pending >= E.hl_frontier) E.hl_pending = -1;
 
-	++E.numrows;
-	++E.dirty;
+	/* the row that moved up is now entered with another state */
+	editorSyntaxDirty(at);
+	editorSyntaxSettle(E.rowoffset + E.screenrows, HL_SYNC_BUDGET);
 }
 
-void editorFreeRow(erow* row) {
-	free(row->render);
-	free(row->chars);
-	free(row->hl);
-}
+/* keeps the comment state chain current after row has changed, but only
+ * as far as the screen reaches; the rest is finished in idle time and hl
+ * itself is rebuilt lazily by editorRowPrepare for rows that get drawn */
+void editorUpdateSyntax(erow* row) {
+	if (E.syntax == NULL) return;
 
-void editorDelRow(int at) {
-	if (at < 0 || at >= E.numrows) return;
+	editorSyntaxDirty(editorRowIndex(row));
+	if (!E.hl_batch) {
+		editorSyntaxSettle(E.rowoffset + E.screenrows, HL_SYNC_BUDGET);
+	}
+}
 
-	editorFreeRow(&E.row[at]);
-	memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numrows - at - 1));
+/* threads the parallel pass may run on, one per core up to HL_MAX_WORKERS */
+int editorSyntaxWorkers() {
+	static int workers = 0;
 
-	for (int j = at; j < E.numrows - 1; ++j) {
-		--E.row[j].idx;
+	if (workers == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		workers = cpus < 1 ? 1 : (cpus > HL_MAX_WORKERS ? HL_MAX_WORKERS : cpus);
 	}
 
-	--E.numrows;
+	return workers;
+}
+
+/* only the rows of the chunk are written, so workers never share a row */
+void editorSyntaxChunk(hlChunk* chunk) {
+	erow* row = editorRowAt(chunk->from);
+	int in_comment = 0;
+
+	for (int at = chunk->from; at < chunk->to; ++at) {
+		in_comment = editorSyntaxLex(editorRowText(row), row->size, NULL, in_comment);
+		row->hl_open_comment = in_comment;
+		row = editorRowNext(row);
+	}
+	chunk->out = in_comment;
+	chunk->done = 1;
+}
+
+void* editorSyntaxWorker(void* arg) {
+	(void)arg;
+
+	while (!__atomic_load_n(&HP.stop, __ATOMIC_RELAXED)) {
+		int k = __atomic_fetch_add(&HP.next, 1, __ATOMIC_RELAXED);
+		if (k >= HP.num_chunks) break;
+
+		editorSyntaxChunk(&HP.chunks[k]);
+	}
+
+	return NULL;
+}
+
+/* settles the rows from the frontier on with the main thread and workers-1
+ * threads lexing chunks; with interruptible set it stops taking chunks once
+ * a key is ready, and the frontier moves past the chunks finished in a row.
+ * Rows edited since they were lexed have to be settled by the walk first.
+ * Returns 1 once every row is settled */
+int editorSyntaxSettleParallel(int workers, int interruptible) {
+	if (E.syntax == NULL) return 1;
+	if (E.hl_pending != -1) return 0;
+
+	editorGapClose(); //workers read the rows whole
+
+	int start = E.hl_frontier;
+	HP.num_chunks = (E.numrows - start + HL_CHUNK_ROWS - 1) / HL_CHUNK_ROWS;
+	HP.chunks = realloc(HP.chunks, sizeof(hlChunk) * (HP.num_chunks ? HP.num_chunks : 1));
+	if (HP.chunks == NULL) {
+		quit_error("realloc error in editorSyntaxSettleParallel");
+	}
+	for (int k = 0; k < HP.num_chunks; ++k) {
+		HP.chunks[k].from = start + k * HL_CHUNK_ROWS;
+		HP.chunks[k].to = k + 1 < HP.num_chunks ? HP.chunks[k].from + HL_CHUNK_ROWS : E.numrows;
+		HP.chunks[k].done = 0;
+	}
+	HP.next = 0;
+	HP.stop = 0;
+
+	pthread_t threads[HL_MAX_WORKERS];
+	int started = 0;
+	for (int i = 1; i < workers && i < HL_MAX_WORKERS; ++i) {
+		if (pthread_create(&threads[started], NULL, editorSyntaxWorker, NULL) == 0) {
+			++started;
+		}
+	}
+
+	/* the main thread takes chunks as well, looking for input in between */
+	while (1) {
+		if (interruptible && editorEventKeyReady()) {
+			__atomic_store_n(&HP.stop, 1, __ATOMIC_RELAXED);
+			break;
+		}
+		int k = __atomic_fetch_add(&HP.next, 1, __ATOMIC_RELAXED);
+		if (k >= HP.num_chunks) break;
+
+		editorSyntaxChunk(&HP.chunks[k]);
+	}
+	for (int i = 0; i < started; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+
+	erow* prev = start ? editorRowAt(start - 1) : NULL;
+	int in_comment = prev ? prev->hl_open_comment : 0;
+
+	for (int k = 0; k < HP.num_chunks && HP.chunks[k].done; ++k) {
+		hlChunk* chunk = &HP.chunks[k];
+		int out = chunk->out;
+
+		if (in_comment) {
+			/* the guess was wrong, lex again until a row ends the same */
+			erow* row = editorRowAt(chunk->from);
+			int at;
+			for (at = chunk->from; at < chunk->to; ++at) {
+				int state = editorSyntaxLex(editorRowText(row), row->size, NULL, in_comment);
+				if (state == row->hl_open_comment) break;
+
+				row->hl_open_comment = in_comment = state;
+				row = editorRowNext(row);
+			}
+			if (at == chunk->to) {
+				out = in_comment;
+			}
+		}
+		in_comment = out;
+		E.hl_frontier = chunk->to;
+	}
+
+	return E.hl_frontier >= E.numrows;
+}
+
+int editorSyntaxToColor(int hl) {
+	switch (hl) {
+		case HL_COMMENT:
+		case HL_MLCOMMENT: return 36;
+		case HL_KEYWORD1: return 33;
+		case HL_KEYWORD2: return 32;
+		case HL_STRING: return 35;
+		case HL_NUMBER: return 31;
+		case HL_MATCH: return 34;
+
+		default: return 37;
+	}
+}
+
+void editorSelectSyntaxHighlight() {
+	E.syntax = NULL;
+	if (E.filename == NULL) return;
+
+	char* ext = strrchr(E.filename, '.');
+
+	for (unsigned int j = 0; j < HLDB_ENTRIES; ++j) {
+		struct editorSyntax* s = &HLDB[j];
+		unsigned int i = 0;
+
+		while (s->filematch[i]) {
+			int is_ext = (s->filematch[i][0] == '.');
+
+			if ((is_ext && ext && !strcmp(ext, s->filematch[i])) ||
+				(!is_ext && strstr(E.filename, s->filematch[i]))) {
+				if (s->kwtable == NULL) {
+					editorSyntaxCompile(s);
+				}
+				E.syntax = s;
+				E.hl_frontier = 0; //rows get lexed again as they are needed
+				E.hl_pending = -1;
+				E.hl_dirty_end = -1;
+				editorInvalidateRowCache();
+
+				return;
+			}
+			++i;
+		}
+	}
+}
+
+/* row storage func realization */
+void* slabAlloc(slab* s) {
+	void* p = s->free_list;
+	if (p) {
+		s->free_list = *(void**)p;
+	}
+	else {
+		if (s->num_pages == 0 || s->used + s->size > SLAB_PAGE) {
+			if (s->num_pages == s->pages_cap) {
+				s->pages_cap = s->pages_cap ? s->pages_cap * 2 : 16;
+				s->pages = realloc(s->pages, sizeof(char*) * s->pages_cap);
+			}
+			char* page = malloc(SLAB_PAGE);
+			if (page == NULL || s->pages == NULL) {
+				quit_error("malloc error in slabAlloc");
+			}
+			s->pages[s->num_pages++] = page;
+			s->used = 0;
+		}
+		p = &s->pages[s->num_pages - 1][s->used];
+		s->used += s->size;
+	}
+	++s->in_use;
+
+	return p;
+}
+
+void slabFree(slab* s, void* p) {
+	*(void**)p = s->free_list;
+	s->free_list = p;
+	--s->in_use;
+}
+
+/* gives back every page at once, whatever blocks are still handed out */
+void slabRelease(slab* s) {
+	for (int i = 0; i < s->num_pages; ++i) {
+		free(s->pages[i]);
+	}
+	free(s->pages);
+	s->pages = NULL;
+	s->num_pages = 0;
+	s->pages_cap = 0;
+	s->free_list = NULL;
+	s->used = 0;
+	s->in_use = 0;
+}
+
+/* room for cap bytes of row text from the smallest text slab that fits,
+ * or from malloc when none does; *from gets what erow.text_slab holds */
+char* editorTextAlloc(size_t cap, unsigned char* from) {
+	for (int i = 0; i < TEXT_SLABS; ++i) {
+		if (cap <= (size_t)RS.text[i].size) {
+			*from = i + 1;
+			return slabAlloc(&RS.text[i]);
+		}
+	}
+
+	char* chars = malloc(cap);
+	if (chars == NULL) {
+		quit_error("malloc error in editorTextAlloc");
+	}
+	*from = 0;
+
+	return chars;
+}
+
+slab* editorTextSlab(erow* row) {
+	return row->text_slab ? &RS.text[row->text_slab - 1] : NULL;
+}
+
+/* closes the buffer: what single rows own on the heap (long texts, lexers,
+ * caches) is freed, erows, tree nodes and short texts go with the pages of
+ * their slabs. The mapping the rows pointed into is let go, and the undo
+ * records and the journal, which name rows by number, are dropped with them */
+void editorFreeRows() {
+	editorLoadPoll(1); //the reader may still hand rows over
+	editorSavePoll(1); //the writer may still read row text
+
+	for (erow* row = editorRowAt(0); row; row = editorRowNext(row)) {
+		if (row->lex) {
+			free(row->lex->points);
+			free(row->lex->blocks);
+			free(row->lex);
+		}
+		if (row->chars && row->chars != row->data.text && row->text_slab == 0) {
+			free(row->chars);
+		}
+	}
+	for (int i = 0; i < E.num_cached; ++i) {
+		free(E.cached_rows[i]->cache);
+	}
+	E.num_cached = 0;
+	G.row = NULL;
+
+	slabRelease(&RS.rows);
+	slabRelease(&RS.nodes);
+	for (int i = 0; i < TEXT_SLABS; ++i) {
+		slabRelease(&RS.text[i]);
+	}
+
+	E.rowtree = rtNewNode(1);
+	E.numrows = 0;
+	E.hl_frontier = 0;
+	E.hl_pending = -1;
+	E.hl_dirty_end = -1;
+	E.cursor_x = 0;
+	E.cursor_y = 0;
+	E.render_x = 0;
+	E.rowoffset = 0;
+	E.coloffset = 0;
+	E.repaint = 1;
+
+	if (E.map) {
+		if (E.map_heap) {
+			free(E.map);
+		}
+		else {
+			munmap(E.map, E.map_size);
+		}
+	}
+	E.map = NULL;
+	E.map_size = 0;
+	E.map_heap = 0;
+
+	U.head = U.count = U.cur = 0;
+	U.bstart = U.bend = 0;
+	U.can_merge = 0;
+	U.sealed = 1;
+	editorJournalClose();
+	E.dirty = 0;
+}
+
+void editorShowRowStats() {
+	size_t text = 0;
+	int pages = RS.rows.num_pages + RS.nodes.num_pages;
+	for (int i = 0; i < TEXT_SLABS; ++i) {
+		text += RS.text[i].in_use * RS.text[i].size;
+		pages += RS.text[i].num_pages;
+	}
+
+	editorSetStatusMessage("row slabs: %zu rows, %zu nodes, %zu KB of text in %d pages of %d KB",
+			RS.rows.in_use, RS.nodes.in_use, text >> 10, pages, SLAB_PAGE >> 10);
+}
+
+/* row tree func realization */
+rownode* rtNewNode(int leaf) {
+	rownode* node = slabAlloc(&RS.nodes);
+	memset(node, 0, sizeof(rownode));
+	node->leaf = leaf;
+
+	return node;
+}
+
+void rtAdopt(rownode* node, int from) {
+	for (int i = from; i < node->count; ++i) {
+		if (node->leaf) {
+			erow* row = node->slot[i];
+			row->leaf = node;
+			row->slot = i;
+		}
+		else {
+			((rownode*)node->slot[i])->parent = node;
+		}
+	}
+}
+
+int rtChildPos(rownode* node) {
+	int i = 0;
+	while (node->parent->slot[i] != node) {
+		++i;
+	}
+
+	return i;
+}
+
+/* moves the slots of node from half on into a new sibling after it */
+void rtSplit(rownode* node, int half) {
+	if (node->parent && node->parent->count == ROWTREE_SLOTS) {
+		rtSplit(node->parent, ROWTREE_SLOTS / 2);
+	}
+
+	rownode* sibling = rtNewNode(node->leaf);
+
+	sibling->count = node->count - half;
+	memcpy(sibling->slot, &node->slot[half], sizeof(void*) * sibling->count);
+	node->count = half;
+	rtAdopt(sibling, 0);
+
+	for (int i = 0; i < sibling->count; ++i) {
+		sibling->total += node->leaf ? 1 : ((rownode*)sibling->slot[i])->total;
+	}
+	node->total -= sibling->total;
+
+	if (node->leaf) {
+		sibling->prev = node;
+		sibling->next = node->next;
+		if (node->next) {
+			node->next->prev = sibling;
+		}
+		node->next = sibling;
+	}
+
+	if (node->parent == NULL) {
+		rownode* root = rtNewNode(0);
+		root->slot[0] = node;
+		root->slot[1] = sibling;
+		root->count = 2;
+		root->total = node->total + sibling->total;
+		rtAdopt(root, 0);
+		E.rowtree = root;
+		return;
+	}
+
+	rownode* parent = node->parent;
+	int pos = rtChildPos(node) + 1;
+	memmove(&parent->slot[pos + 1], &parent->slot[pos], sizeof(void*) * (parent->count - pos));
+	parent->slot[pos] = sibling;
+	parent->count++;
+	sibling->parent = parent;
+}
+
+void rtInsert(int at, erow* row) {
+	rownode* node = E.rowtree;
+	int pos = at;
+	while (!node->leaf) {
+		int i;
+		if (pos == node->total) {
+			/* appending, as a file being read does, goes down the right edge
+			 * without summing up every child on the way */
+			i = node->count - 1;
+			pos -= node->total - ((rownode*)node->slot[i])->total;
+		}
+		else {
+			for (i = 0; i < node->count - 1; ++i) {
+				rownode* child = node->slot[i];
+				if (pos < child->total) break;
+				pos -= child->total;
+			}
+		}
+		node = node->slot[i];
+	}
+
+	/* rows added at the end, like a file being read, start a new leaf and
+	 * leave the full one as it is, so leaves of a loaded file are packed */
+	if (node->count == ROWTREE_SLOTS) {
+		rtSplit(node, pos == node->count && node->next == NULL ? node->count : node->count / 2);
+		rtInsert(at, row);
+		return;
+	}
+
+	memmove(&node->slot[pos + 1], &node->slot[pos], sizeof(void*) * (node->count - pos));
+	node->slot[pos] = row;
+	node->count++;
+	rtAdopt(node, pos);
+
+	for (; node; node = node->parent) {
+		node->total++;
+	}
+}
+
+void rtRemove(erow* row) {
+	rownode* leaf = row->leaf;
+	int pos = row->slot;
+
+	memmove(&leaf->slot[pos], &leaf->slot[pos + 1], sizeof(void*) * (leaf->count - pos - 1));
+	leaf->count--;
+	rtAdopt(leaf, pos);
+
+	for (rownode* node = leaf; node; node = node->parent) {
+		node->total--;
+	}
+
+	if (E.rowtree->total == 0) {
+		rtFree(E.rowtree);
+		E.rowtree = rtNewNode(1);
+		return;
+	}
+
+	rtRebalance(leaf);
+}
+
+void rtFree(rownode* node) {
+	if (!node->leaf) {
+		for (int i = 0; i < node->count; ++i) {
+			rtFree(node->slot[i]);
+		}
+	}
+	slabFree(&RS.nodes, node);
+}
+
+void rtRebalance(rownode* node) {
+	while (node->parent && node->count < ROWTREE_SLOTS / 4) {
+		rownode* parent = node->parent;
+		int pos = rtChildPos(node);
+
+		if (parent->count == 1) break;
+
+		rownode* left = pos > 0 ? parent->slot[pos - 1] : node;
+		rownode* right = pos > 0 ? node : parent->slot[pos + 1];
+		int lpos = pos > 0 ? pos - 1 : pos;
+
+		if (left->count + right->count <= ROWTREE_SLOTS) {
+			int from = left->count;
+			memcpy(&left->slot[from], right->slot, sizeof(void*) * right->count);
+			left->count += right->count;
+			left->total += right->total;
+			rtAdopt(left, from);
+
+			if (left->leaf) {
+				left->next = right->next;
+				if (right->next) {
+					right->next->prev = left;
+				}
+			}
+
+			memmove(&parent->slot[lpos + 1], &parent->slot[lpos + 2],
+					sizeof(void*) * (parent->count - lpos - 2));
+			parent->count--;
+			slabFree(&RS.nodes, right);
+			node = parent;
+		}
+		else {
+			/* too many for one node, share them out evenly instead */
+			int all = left->count + right->count;
+			int move = all / 2 - left->count;
+			if (move > 0) {
+				memcpy(&left->slot[left->count], right->slot, sizeof(void*) * move);
+				memmove(right->slot, &right->slot[move], sizeof(void*) * (right->count - move));
+			}
+			else {
+				memmove(&right->slot[-move], right->slot, sizeof(void*) * right->count);
+				memcpy(right->slot, &left->slot[left->count + move], sizeof(void*) * -move);
+			}
+			left->count += move;
+			right->count -= move;
+			rtAdopt(left, 0);
+			rtAdopt(right, 0);
+
+			int total = left->total + right->total;
+			left->total = 0;
+			for (int i = 0; i < left->count; ++i) {
+				left->total += left->leaf ? 1 : ((rownode*)left->slot[i])->total;
+			}
+			right->total = total - left->total;
+			break;
+		}
+	}
+
+	while (!E.rowtree->leaf && E.rowtree->count == 1) {
+		rownode* root = E.rowtree;
+		E.rowtree = root->slot[0];
+		E.rowtree->parent = NULL;
+		slabFree(&RS.nodes, root);
+	}
+}
+
+erow* editorRowAt(int at) {
+	if (at < 0 || at >= E.rowtree->total) return NULL;
+
+	rownode* node = E.rowtree;
+	while (!node->leaf) {
+		int i = 0;
+		while (at >= ((rownode*)node->slot[i])->total) {
+			at -= ((rownode*)node->slot[i])->total;
+			++i;
+		}
+		node = node->slot[i];
+	}
+
+	return node->slot[at];
+}
+
+int editorRowIndex(erow* row) {
+	int idx = row->slot;
+	for (rownode* node = row->leaf; node->parent; node = node->parent) {
+		int pos = rtChildPos(node);
+		for (int i = 0; i < pos; ++i) {
+			idx += ((rownode*)node->parent->slot[i])->total;
+		}
+	}
+
+	return idx;
+}
+
+erow* editorRowNext(erow* row) {
+	if (row->slot + 1 < row->leaf->count) {
+		return row->leaf->slot[row->slot + 1];
+	}
+
+	return row->leaf->next ? row->leaf->next->slot[0] : NULL;
+}
+
+erow* editorRowPrev(erow* row) {
+	if (row->slot > 0) {
+		return row->leaf->slot[row->slot - 1];
+	}
+
+	rownode* prev = row->leaf->prev;
+	return prev ? prev->slot[prev->count - 1] : NULL;
+}
+
+/* row operations func realization */
+/* long rows look the column up in their index and walk one block of it,
+ * others walk the text from tab to tab, and across a gap without closing it */
+int editorRowCxToRx(erow* row, int cx) {
+	if (row->size >= ROW_LONG) {
+		editorColsBuild(row);
+		colBlock* b = &row->lex->blocks[editorColsFind(row, cx, 0)];
+		return editorRenderWidth(editorRowBytes(row, b->from, cx - b->from), cx - b->from, b->col);
+	}
+
+	const char* text;
+	const char* tail;
+	int head = editorRowParts(row, &text, &tail);
+
+	if (cx <= head) return editorRenderWidth(text, cx, 0);
+
+	return editorRenderWidth(tail, cx - head, editorRenderWidth(text, head, 0));
+}
+
+int editorRowRxToCx(erow* row, int rx) {
+	if (row->size >= ROW_LONG) {
+		editorColsBuild(row);
+		colBlock* b = &row->lex->blocks[editorColsFind(row, rx, 1)];
+		int cur_rx = b->col;
+		return b->from + editorRenderSeek(editorRowBytes(row, b->from, b->bytes), b->bytes, &cur_rx, rx);
+	}
+
+	const char* text;
+	const char* tail;
+	int head = editorRowParts(row, &text, &tail);
+	int cur_rx = 0; //rx stands for render x
+
+	int cx = editorRenderSeek(text, head, &cur_rx, rx); //cx stands for cursor_x
+	if (cx < head) return cx;
+
+	return head + editorRenderSeek(tail, row->size - head, &cur_rx, rx);
+}
+
+/* column that len bytes of text end at when they start at column rx */
+int editorRenderWidth(const char* text, int len, int rx) {
+	const char* end = text + len;
+	while (text < end) {
+		const char* tab = memchr(text, '\t', end - text);
+		if (tab == NULL) return rx + (end - text);
+
+		rx += tab - text;
+		rx += CTRLC_TAB_STOP - (rx % CTRLC_TAB_STOP);
+		text = tab + 1;
+	}
+
+	return rx;
+}
+
+/* walks len bytes of text on from column *cur and returns the first one
+ * that reaches past column rx, or len when none does */
+int editorRenderSeek(const char* text, int len, int* cur, int rx) {
+	int j = 0;
+	while (j < len) {
+		const char* tab = memchr(&text[j], '\t', len - j);
+		int run = (tab ? tab - text : len) - j;
+		if (*cur + run > rx) return j + (rx - *cur);
+
+		*cur += run;
+		j += run;
+		if (j == len) break;
+
+		*cur += CTRLC_TAB_STOP - (*cur % CTRLC_TAB_STOP);
+		if (*cur > rx) return j;
+		++j;
+	}
+
+	return len;
+}
+
+int editorRenderText(char* render, const char* chars, int size) {
+	int idx = 0;
+	for (int j = 0; j < size; ++j) {
+		if (chars[j] == '\t') {
+			render[idx++] = ' ';
+			while (idx % CTRLC_TAB_STOP != 0) {
+				render[idx++] = ' ';
+			}
+		}
+		else {
+			render[idx++] = chars[j];
+		}
+	}
+	render[idx] = '\0';
+
+	return idx;
+}
+
+/* del bytes at at were replaced by len others */
+void editorUpdateRow(erow* row, int at, int del, int len) {
+	editorRowEdited(row, at, del, len);
+	row->flags |= ROW_DIRTY;
+	editorUpdateSyntax(row);
+}
+
+void editorInsertRow(int at, char* string, size_t len) {
+	if (at < 0 || at > E.numrows) return;
+
+	erow* row = slabAlloc(&RS.rows);
+	rtInsert(at, row);
+	++E.numrows;
+
+	row->size = len;
+	row->text_slab = 0;
+	row->chars = len < ROW_INLINE ? row->data.text : editorTextAlloc(len + 1, &row->text_slab);
+	memcpy(row->chars, string, len);
+	row->chars[len] = '\0';
+
+	row->cache = NULL;
+	row->flags = 0;
+	row->lex = NULL;
+
+	/* start out with the state the following row was lexed with, so that
+	 * the update below only propagates if the new row really changes it */
+	erow* prev = editorRowPrev(row);
+	row->hl_open_comment = prev ? prev->hl_open_comment : 0;
+	editorSyntaxRowInserted(at);
+	editorUpdateRow(row, 0, 0, len);
+	editorEditRecord(EDIT_INSERT_ROW, at, 0, NULL, 0, string, len);
+
+	++E.dirty;
+}
+
+void editorInsertMappedRow(int at, size_t src, size_t len) {
+	if (at < 0 || at > E.numrows) return;
+
+	erow* row = slabAlloc(&RS.rows);
+	rtInsert(at, row);
+	++E.numrows;
+
+	row->size = len;
+	row->chars = NULL;
+	row->text_slab = 0;
+	row->data.src = src;
+
+	row->cache = NULL;
+	row->hl_open_comment = 0;
+	row->flags = 0;
+	row->lex = NULL;
+	editorSyntaxRowInserted(at);
+	editorSyntaxDirty(at);
+}
+
+/* gives the row text of its own to edit: copies it out of the original
+ * text, or out of chars that a running save is still writing */
+void editorRowMaterialize(erow* row) {
+	if (row->chars && !(row->flags & ROW_SHARED)) return;
+
+	if (row->chars && !SV.active) {
+		row->flags &= ~ROW_SHARED; //left over from a save that has finished
+		return;
+	}
+
+	/* the text stays valid, it is in the map or in chars the save holds on
+	 * to; those may be inside the row, then the copy goes to the heap */
+	const char* text = editorRowText(row);
+	editorRowDropChars(row);
+	row->chars = row->size < ROW_INLINE && text != row->data.text ? row->data.text : editorTextAlloc(row->size + 1, &row->text_slab);
+	memcpy(row->chars, text, row->size);
+	row->chars[row->size] = '\0';
+}
+
+/* makes room for cap bytes in the row's own chars, taking them out of the
+ * erow or out of their slab once they no longer fit there */
+void editorRowReserve(erow* row, size_t cap) {
+	slab* from = editorTextSlab(row);
+	if (row->chars == row->data.text || from) {
+		size_t room = from ? (size_t)from->size : ROW_INLINE;
+		if (cap <= room) return;
+
+		char* chars = editorTextAlloc(cap, &row->text_slab);
+		memcpy(chars, row->chars, room);
+		if (from) {
+			slabFree(from, row->chars);
+		}
+		row->chars = chars;
+		return;
+	}
+
+	row->chars = realloc(row->chars, cap);
+	if (row->chars == NULL) {
+		quit_error("realloc error in editorRowReserve");
+	}
+}
+
+/* lets go of the row's chars, which wait for the save if it still reads
+ * them; chars inside the erow go with it, see editorDelRow */
+void editorRowDropChars(erow* row) {
+	if (row->chars == row->data.text) {
+		if ((row->flags & ROW_SHARED) && SV.active) {
+			row->flags |= ROW_HELD;
+		}
+	}
+	else if ((row->flags & ROW_SHARED) && SV.active && row->chars) {
+		editorSaveOrphan(row->chars, editorTextSlab(row));
+	}
+	else if (row->text_slab) {
+		slabFree(editorTextSlab(row), row->chars);
+	}
+	else {
+		free(row->chars);
+	}
+	row->chars = NULL;
+	row->text_slab = 0;
+	row->flags &= ~ROW_SHARED;
+}
+
+char* editorRowText(erow* row) {
+	if (row == G.row) {
+		editorGapClose();
+	}
+
+	return row->chars ? row->chars : &E.map[row->data.src];
+}
+
+/* the text of the row as the bytes before its gap, whose count is
+ * returned, and the bytes after it; a row without a gap is all head */
+int editorRowParts(erow* row, const char** head, const char** tail) {
+	const char* text = row->chars ? row->chars : &E.map[row->data.src];
+	*head = text;
+
+	if (row == G.row) {
+		*tail = &text[G.at + G.len];
+		return G.at;
+	}
+
+	*tail = &text[row->size];
+	return row->size;
+}
+
+/* len bytes of the row from at in one piece; when they run across the gap
+ * they are copied out, into a buffer the next call reuses */
+const char* editorRowBytes(erow* row, int at, int len) {
+	static char* buff = NULL;
+	static int cap = 0;
+
+	const char* text;
+	const char* tail;
+	int head = editorRowParts(row, &text, &tail);
+	if (at + len <= head) return &text[at];
+	if (at >= head) return &tail[at - head];
+
+	if (len > cap) {
+		cap = len;
+		buff = realloc(buff, cap);
+		if (buff == NULL) {
+			quit_error("realloc error in editorRowBytes");
+		}
+	}
+	memcpy(buff, &text[at], head - at);
+	memcpy(&buff[head - at], tail, at + len - head);
+
+	return buff;
+}
+
+/* moves the gap, opening it in row first if it is elsewhere, to at with at
+ * least room free bytes in it */
+void editorGapOpen(erow* row, int at, int room) {
+	if (row != G.row) {
+		editorGapClose();
+		editorRowMaterialize(row);
+		G.row = row;
+		G.at = row->size;
+		G.len = 1; //the byte of the terminating '\0'
+	}
+
+	if (G.len < room + 1) {
+		int len = room + 1 + ROW_GAP + row->size / 16;
+		editorRowReserve(row, row->size + len);
+		memmove(&row->chars[G.at + len], &row->chars[G.at + G.len], row->size - G.at);
+		G.len = len;
+	}
+
+	if (at < G.at) {
+		memmove(&row->chars[at + G.len], &row->chars[at], G.at - at);
+	}
+	else if (at > G.at) {
+		memmove(&row->chars[G.at], &row->chars[G.at + G.len], at - G.at);
+	}
+	G.at = at;
+}
+
+/* puts the gap at the end of its row, which leaves the text in one piece */
+void editorGapClose() {
+	erow* row = G.row;
+	if (row == NULL) return;
+
+	memmove(&row->chars[G.at], &row->chars[G.at + G.len], row->size - G.at);
+	row->chars[row->size] = '\0';
+	G.row = NULL;
+}
+
+rowLex* editorRowLex(erow* row) {
+	if (row->lex == NULL) {
+		row->lex = calloc(1, sizeof(rowLex));
+		if (row->lex == NULL) {
+			quit_error("calloc error in editorRowLex");
+		}
+		row->lex->dirty_from = -1;
+		row->lex->win_col = -1;
+	}
+
+	return row->lex;
+}
+
+/* del bytes at at were replaced by len others: checkpoints after them
+ * move along, those the change may have affected are lexed again later,
+ * and the blocks of the column index it touched are cut anew */
+void editorRowEdited(erow* row, int at, int del, int len) {
+	rowLex* lex = row->lex;
+	if (lex == NULL) return;
+
+	if (lex->blocks && row->size < ROW_LONG) {
+		free(lex->blocks);
+		lex->blocks = NULL;
+		lex->num_blocks = lex->blocks_cap = lex->blocks_valid = 0;
+	}
+	else if (lex->blocks) {
+		int j = editorColsFind(row, at, 0);
+		int k = editorColsFind(row, at + del, 0);
+		colBlock* b = lex->blocks;
+		int to = b[k].from + b[k].bytes + len - del;
+		if (to - b[j].from < COL_BLOCK / 2 && k + 1 < lex->num_blocks) {
+			to += b[++k].bytes; //keeps deletes from leaving crumbs of blocks behind
+		}
+		editorColsSplice(row, j, k + 1, b[j].from, to);
+	}
+
+	int shift = len - del;
+	int kept = 0;
+	for (int i = 0; i < lex->count; ++i) {
+		lexPoint* point = &lex->points[i];
+		if (point->pos > at && point->pos <= at + del) continue;
+		if (point->pos > at) point->pos += shift;
+		lex->points[kept++] = *point;
+	}
+	lex->count = kept;
+
+	if (lex->dirty_from == -1) {
+		lex->dirty_from = at;
+		lex->dirty_to = at + len;
+	}
+	else {
+		if (lex->dirty_to > at) {
+			lex->dirty_to = lex->dirty_to + shift > at + len ? lex->dirty_to + shift : at + len;
+		}
+		else {
+			lex->dirty_to = at + len;
+		}
+		if (at < lex->dirty_from) lex->dirty_from = at;
+	}
+}
+
+/* column the block ends at */
+int editorColsEnd(colBlock* b) {
+	if (!b->tab) return b->col + b->pre;
+
+	int rx = b->col + b->pre;
+	rx += CTRLC_TAB_STOP - (rx % CTRLC_TAB_STOP);
+	return rx + b->tail;
+}
+
+void editorColsScan(erow* row, int from, int bytes, colBlock* b) {
+	const char* text = editorRowBytes(row, from, bytes);
+	const char* tab = memchr(text, '\t', bytes);
+
+	b->from = from;
+	b->bytes = bytes;
+	b->tab = tab != NULL;
+	b->pre = tab ? tab - text : bytes;
+	b->tail = tab ? editorRenderWidth(tab + 1, text + bytes - tab - 1, 0) : 0;
+}
+
+/* puts blocks for the bytes from from up to to in place of blocks j up to k */
+void editorColsSplice(erow* row, int j, int k, int from, int to) {
+	rowLex* lex = row->lex;
+	int n = (to - from) / COL_BLOCK;
+	if (n == 0 && to > from) n = 1;
+
+	int count = lex->num_blocks - (k - j) + n;
+	if (count > lex->blocks_cap) {
+		lex->blocks_cap = count * 2;
+		lex->blocks = realloc(lex->blocks, lex->blocks_cap * sizeof(colBlock));
+		if (lex->blocks == NULL) {
+			quit_error("realloc error in editorColsSplice");
+		}
+	}
+	memmove(&lex->blocks[j + n], &lex->blocks[k], (lex->num_blocks - k) * sizeof(colBlock));
+	for (int i = 0; i < n; ++i) {
+		int a = from + (long long)(to - from) * i / n;
+		int b = from + (long long)(to - from) * (i + 1) / n;
+		editorColsScan(row, a, b - a, &lex->blocks[j + i]);
+	}
+
+	lex->num_blocks = count;
+	if (lex->blocks_valid > j) lex->blocks_valid = j;
+}
+
+void editorColsBuild(erow* row) {
+	rowLex* lex = editorRowLex(row);
+	if (lex->blocks) return;
+
+	editorColsSplice(row, 0, 0, 0, row->size);
+}
+
+/* index of the block holding byte at, or column at when by_col. Where the
+ * blocks start is summed up lazily, only as far as a lookup needs */
+int editorColsFind(erow* row, int at, int by_col) {
+	rowLex* lex = row->lex;
+	colBlock* b = lex->blocks;
+	if (lex->blocks_valid == 0) {
+		b[0].from = 0;
+		b[0].col = 0;
+		lex->blocks_valid = 1;
+	}
+
+	while (lex->blocks_valid < lex->num_blocks) {
+		colBlock* last = &b[lex->blocks_valid - 1];
+		if ((by_col ? last->col : last->from) > at) break;
+
+		last[1].from = last->from + last->bytes;
+		last[1].col = editorColsEnd(last);
+		++lex->blocks_valid;
+	}
+
+	int lo = 0, hi = lex->blocks_valid - 1;
+	while (lo < hi) {
+		int mid = (lo + hi + 1) / 2;
+		if ((by_col ? b[mid].col : b[mid].from) <= at) {
+			lo = mid;
+		}
+		else {
+			hi = mid - 1;
+		}
+	}
+
+	return lo;
+}
+
+/* brings the checkpoints of a long row up to date and returns the state
+ * it ends in. Lexing starts at the last checkpoint the changes cannot have
+ * reached and stops at the first old checkpoint past them that comes out
+ * with the same state, from there on nothing differs */
+int editorRowLexUpdate(erow* row, int in_comment) {
+	static lexPoint* fresh = NULL; //checkpoints lexed now, spliced in at the end
+	static int fresh_cap = 0;
+	static unsigned char* hl = NULL; //the lexer has to write hl to track numbers and keywords
+	static int hl_cap = 0;
+
+	rowLex* lex = editorRowLex(row);
+	if (lex->syntax != E.syntax || lex->in_comment != in_comment) {
+		lex->syntax = E.syntax;
+		lex->in_comment = in_comment;
+		lex->count = 0;
+		lex->dirty_from = 0;
+		lex->dirty_to = row->size;
+	}
+	if (lex->dirty_from == -1) return lex->out;
+
+	int keep = 0; //checkpoints before keep still hold
+	while (keep < lex->count && lex->points[keep].pos + LEX_LOOKAHEAD <= lex->dirty_from) ++keep;
+	int old = keep; //old checkpoints from here on are compared against
+	while (old < lex->count && lex->points[old].pos < lex->dirty_to) ++old;
+
+	lexState state = { in_comment, 0, 1, HL_NORMAL, 0 };
+	int pos = 0;
+	if (keep > 0) {
+		pos = lex->points[keep - 1].pos;
+		state = lex->points[keep - 1].state;
+	}
+
+	int num_fresh = 0;
+	int converged = 0;
+	while (pos < row->size) {
+		while (old < lex->count && lex->points[old].pos <= pos) ++old;
+
+		int to = pos + LEX_CHECKPOINT;
+		if (old < lex->count && lex->points[old].pos < to) to = lex->points[old].pos;
+		if (to > row->size) to = row->size;
+		int len = to + LEX_LOOKAHEAD < row->size ? to + LEX_LOOKAHEAD - pos : row->size - pos;
+
+		if (len > hl_cap) {
+			hl_cap = len;
+			hl = realloc(hl, hl_cap);
+			if (hl == NULL) {
+				quit_error("realloc error in editorRowLexUpdate");
+			}
+		}
+		memset(hl, HL_NORMAL, len);
+		pos += editorSyntaxLexSpan(editorRowBytes(row, pos, len), to - pos, len, hl, &state);
+		if (pos >= row->size) break;
+
+		if (old < lex->count && lex->points[old].pos == pos &&
+				!memcmp(&lex->points[old].state, &state, sizeof(lexState))) {
+			converged = 1;
+			break;
+		}
+
+		if (num_fresh == fresh_cap) {
+			fresh_cap = fresh_cap ? fresh_cap * 2 : 64;
+			fresh = realloc(fresh, sizeof(lexPoint) * fresh_cap);
+			if (fresh == NULL) {
+				quit_error("realloc error in editorRowLexUpdate");
+			}
+		}
+		fresh[num_fresh].pos = pos;
+		fresh[num_fresh].state = state;
+		++num_fresh;
+	}
+
+	int tail = converged ? lex->count - old : 0;
+	int count = keep + num_fresh + tail;
+	if (count > lex->cap) {
+		lex->cap = count * 2;
+		lex->points = realloc(lex->points, sizeof(lexPoint) * lex->cap);
+		if (lex->points == NULL) {
+			quit_error("realloc error in editorRowLexUpdate");
+		}
+	}
+	if (tail) {
+		memmove(&lex->points[keep + num_fresh], &lex->points[old], sizeof(lexPoint) * tail);
+	}
+	if (num_fresh) {
+		memcpy(&lex->points[keep], fresh, sizeof(lexPoint) * num_fresh);
+	}
+	lex->count = count;
+
+	if (!converged) {
+		lex->out = state.in_comment;
+	}
+	lex->dirty_from = -1;
+
+	return lex->out;
+}
+
+/* brings render and hl of the row at index at up to date before they are
+ * drawn or searched; hl is redone when the text changed or when the row is
+ * now entered with a different comment state than it was highlighted with */
+void editorRowPrepare(erow* row, int at) {
+	/* a row past the settled ones is drawn with the best state known so
+	 * far and drawn again once idle time has caught up with it */
+	if (E.syntax && at > editorSyntaxSettled()) {
+		E.hl_provisional = 1;
+	}
+	erow* prev = editorRowPrev(row);
+	int in_comment = (E.syntax && prev) ? prev->hl_open_comment : 0;
+
+	if (row->lex || row->size >= ROW_LONG) {
+		editorRowPrepareLong(row, in_comment);
+		return;
+	}
+
+	static char* render = NULL; //tabs are expanded here before the block has its size
+	static int render_cap = 0;
+	static unsigned char* hl = NULL; //the lexer writes a class per byte, only the runs are kept
+	static int hl_cap = 0;
+
+	if (row->cache && !(row->flags & (ROW_DIRTY | ROW_HL_STALE)) &&
+			in_comment == !!(row->flags & ROW_HL_IN_COMMENT)) {
+		return;
+	}
+
+	char* text = row->cache ? row->cache->render : NULL;
+	int size = row->cache ? row->cache->render_size : 0;
+	int copy = 0;
+	if (row->cache == NULL || (row->flags & ROW_DIRTY)) {
+		text = editorRowText(row);
+		int tabs = 0;
+		for (int i = 0; i < row->size; ++i) {
+			if (text[i] == '\t') ++tabs;
+		}
+
+		size = row->size;
+		if (tabs) {
+			if (row->size + tabs * (CTRLC_TAB_STOP - 1) + 1 > render_cap) {
+				render_cap = row->size + tabs * (CTRLC_TAB_STOP - 1) + 1;
+				render = realloc(render, render_cap);
+			}
+			size = editorRenderText(render, text, row->size);
+			text = render;
+			copy = 1;
+		}
+	}
+
+	if (size + 1 > hl_cap) {
+		hl_cap = size + 1;
+		hl = realloc(hl, hl_cap);
+	}
+	memset(hl, HL_NORMAL, size);
+	if (E.syntax) {
+		editorSyntaxLex(text, size, hl, in_comment);
+	}
+
+	editorRowCacheFill(row, text, size, copy, hl);
+	row->flags = in_comment ? (row->flags | ROW_HL_IN_COMMENT) : (row->flags & ~ROW_HL_IN_COMMENT);
+	row->flags &= ~(ROW_DIRTY | ROW_HL_STALE);
+}
+
+/* puts render and its classes, one per column, into the row's cache with
+ * the classes as runs. render is copied into the block when copy is set,
+ * or when it is there already and the block has to grow */
+void editorRowCacheFill(erow* row, char* render, int render_size, int copy, const unsigned char* hl) {
+	int num_spans = 0;
+	for (int j = 0; j < render_size; ++j) {
+		if (j == 0 || hl[j] != hl[j - 1]) ++num_spans;
+	}
+
+	rowCache* old = row->cache;
+	rowCache* cache = old;
+	int inside = old && old->expanded && render == old->render;
+	if (old == NULL || copy || num_spans > old->spans_cap) {
+		int expanded = copy || inside;
+		cache = malloc(sizeof(rowCache) + sizeof(hlSpan) * num_spans + (expanded ? render_size + 1 : 0));
+		if (cache == NULL) {
+			quit_error("malloc error in editorRowCacheFill");
+		}
+		cache->spans_cap = num_spans;
+		cache->expanded = expanded;
+		if (expanded) {
+			char* held = (char*)&cache->spans[num_spans];
+			memcpy(held, render, render_size);
+			held[render_size] = '\0';
+			render = held;
+		}
+
+		if (old) {
+			cache->slot = old->slot;
+			free(old);
+		}
+		else {
+			if (E.num_cached == E.cached_cap) {
+				E.cached_cap = E.cached_cap ? E.cached_cap * 2 : 64;
+				E.cached_rows = realloc(E.cached_rows, sizeof(erow*) * E.cached_cap);
+			}
+			cache->slot = E.num_cached;
+			E.cached_rows[E.num_cached++] = row;
+		}
+		row->cache = cache;
+	}
+	else {
+		cache->expanded = inside;
+	}
+
+	cache->render = render;
+	cache->render_size = render_size;
+	cache->num_spans = 0;
+	for (int j = 0; j < render_size; ) {
+		int run = j + 1;
+		while (run < render_size && hl[run] == hl[j]) ++run;
+		cache->spans[cache->num_spans].end = run;
+		cache->spans[cache->num_spans].hl = hl[j];
+		++cache->num_spans;
+		j = run;
+	}
+}
+
+/* index of the span holding render column col */
+int editorCacheSpanAt(rowCache* cache, int col) {
+	int lo = 0, hi = cache->num_spans - 1;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (cache->spans[mid].end <= col) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+/* a long row only gets render and hl for the columns on screen: the
+ * lexer starts at the checkpoint before them, so an edit costs the lexing
+ * up to where states meet again plus one screen width, whatever the length
+ * of the row */
+void editorRowPrepareLong(erow* row, int in_comment) {
+	rowLex* lex = editorRowLex(row);
+	if (row->cache && !(row->flags & (ROW_DIRTY | ROW_HL_STALE)) && lex->syntax == E.syntax &&
+			lex->win_col == E.coloffset && lex->win_cols == E.screencols && lex->win_comment == in_comment) {
+		return;
+	}
+
+	int cx = editorRowRxToCx(row, E.coloffset);
+	int rx = editorRowCxToRx(row, cx);
+	int end = cx + E.screencols < row->size ? cx + E.screencols : row->size; //every byte takes a column at least
+
+	lexState state = { in_comment, 0, 1, HL_NORMAL, 0 };
+	int from = cx;
+	if (E.syntax) {
+		editorRowLexUpdate(row, in_comment);
+		from = 0;
+		for (int lo = 0, hi = lex->count; lo < hi; ) {
+			int mid = lo + (hi - lo) / 2;
+			if (lex->points[mid].pos <= cx) {
+				from = lex->points[mid].pos;
+				state = lex->points[mid].state;
+				lo = mid + 1;
+			}
+			else {
+				hi = mid;
+			}
+		}
+	}
+	int len = end + LEX_LOOKAHEAD < row->size ? end + LEX_LOOKAHEAD - from : row->size - from;
+	const char* text = editorRowBytes(row, from, len);
+
+	static unsigned char* hl = NULL;
+	static int hl_cap = 0;
+	if (len + 1 > hl_cap) {
+		hl_cap = len + 1;
+		hl = realloc(hl, hl_cap);
+	}
+	memset(hl, HL_NORMAL, len);
+	if (E.syntax) {
+		editorSyntaxLexSpan(text, end - from, len, hl, &state);
+	}
+
+	/* the window starts at a tab up to a stop left of coloffset and its
+	 * last tab may run a stop past the screen */
+	static char* render = NULL;
+	static unsigned char* render_hl = NULL;
+	static int render_cap = 0;
+	if (E.screencols + 2 * CTRLC_TAB_STOP + 1 > render_cap) {
+		render_cap = E.screencols + 2 * CTRLC_TAB_STOP + 1;
+		render = realloc(render, render_cap);
+		render_hl = realloc(render_hl, render_cap);
+	}
+	int idx = 0;
+	for (int j = cx - from; j < end - from && rx + idx < E.coloffset + E.screencols; ++j) {
+		if (text[j] == '\t') {
+			do {
+				render_hl[idx] = hl[j];
+				render[idx++] = ' ';
+			} while ((rx + idx) % CTRLC_TAB_STOP != 0);
+		}
+		else {
+			render_hl[idx] = hl[j];
+			render[idx++] = text[j];
+		}
+	}
+	editorRowCacheFill(row, render, idx, 1, render_hl);
+	row->flags &= ~(ROW_DIRTY | ROW_HL_STALE);
+
+	lex->render_from = rx;
+	lex->win_col = E.coloffset;
+	lex->win_cols = E.screencols;
+	lex->win_comment = in_comment;
+}
+
+void editorRowDropCache(erow* row) {
+	if (row->cache == NULL) return;
+
+	erow* last = E.cached_rows[--E.num_cached];
+	E.cached_rows[row->cache->slot] = last;
+	last->cache->slot = row->cache->slot;
+
+	free(row->cache);
+	row->cache = NULL;
+}
+
+/* keeps memory bounded by dropping render and hl of rows far off screen */
+void editorTrimRowCache() {
+	if (E.num_cached <= RENDER_CACHE_ROWS) return;
+
+	int keep_from = E.rowoffset - E.screenrows;
+	int keep_to = E.rowoffset + E.screenrows * 2;
+
+	for (int i = E.num_cached - 1; i >= 0; --i) {
+		erow* row = E.cached_rows[i];
+		int at = editorRowIndex(row);
+		if (at < keep_from || at >= keep_to) {
+			editorRowDropCache(row);
+		}
+	}
+}
+
+void editorInvalidateRowCache() {
+	for (int i = 0; i < E.num_cached; ++i) {
+		E.cached_rows[i]->flags |= ROW_HL_STALE;
+	}
+}
+
+void editorFreeRow(erow* row) {
+	if (row == G.row) {
+		G.row = NULL;
+	}
+	if (row->lex) {
+		free(row->lex->points);
+		free(row->lex->blocks);
+		free(row->lex);
+	}
+	editorRowDropCache(row);
+	editorRowDropChars(row);
+}
+
+void editorDelRow(int at) {
+	if (at < 0 || at >= E.numrows) return;
+
+	erow* row = editorRowAt(at);
+	editorEditRecord(EDIT_DELETE_ROW, at, 0, editorRowText(row), row->size, NULL, 0);
+	rtRemove(row);
+	editorFreeRow(row);
+	if ((row->flags & ROW_HELD) && SV.active) {
+		editorSaveOrphan(row, &RS.rows); //the save reads the text inside it
+	}
+	else {
+		slabFree(&RS.rows, row);
+	}
+
+	--E.numrows;
+	++E.dirty;
+
+	editorSyntaxRowDeleted(at);
+}
+
+void editorRowAppendString(erow* row, char* s, size_t len) {
+	editorEditRecord(EDIT_SPLICE, editorRowIndex(row), row->size, NULL, 0, s, len);
+	if (row == G.row || row->size + len >= ROW_LONG) {
+		editorGapOpen(row, row->size, len);
+		memcpy(&row->chars[G.at], s, len);
+		G.at += len;
+		G.len -= len;
+		row->size += len;
+		editorUpdateRow(row, row->size - len, 0, len);
+		++E.dirty;
+		return;
+	}
+
+	editorRowMaterialize(row);
+	editorRowReserve(row, row->size + len + 1);
+	memcpy(&row->chars[row->size], s, len);
+	row->size += len;
+	row->chars[row->size] = '\0';
+	editorUpdateRow(row, row->size - len, 0, len);
+
+	++E.dirty;
+}
+
+void editorRowInsertChar(erow* row, int at, int c) {
+	if (at < 0 || at > row->size) {
+		at = row->size;
+	}
+	char ch = c;
+	editorEditRecord(EDIT_SPLICE, editorRowIndex(row), at, NULL, 0, &ch, 1);
+	if (row == G.row || row->size >= ROW_LONG) {
+		editorGapOpen(row, at, 1);
+		row->chars[G.at++] = c;
+		--G.len;
+		row->size++;
+		editorUpdateRow(row, at, 0, 1);
+		++E.dirty;
+		return;
+	}
+
+	editorRowMaterialize(row);
+	editorRowReserve(row, row->size + 2);
+	memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
+	row->size++;
+	row->chars[at] = c;
+	editorUpdateRow(row, at, 0, 1);
+	++E.dirty;
+}
+
+void editorRowDelChar(erow* row, int at) {
+	if (at < 0 || at >= row->size) return;
+
+	if (row == G.row || row->size >= ROW_LONG) {
+		editorGapOpen(row, at, 0);
+		editorEditRecord(EDIT_SPLICE, editorRowIndex(row), at, &row->chars[G.at + G.len], 1, NULL, 0);
+		++G.len;
+		row->size--;
+		editorUpdateRow(row, at, 1, 0);
+		E.dirty++;
+		return;
+	}
+
+	editorEditRecord(EDIT_SPLICE, editorRowIndex(row), at, &editorRowText(row)[at], 1, NULL, 0);
+	editorRowMaterialize(row);
+	memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
+	row->size--;
+	editorUpdateRow(row, at, 1, 0);
+	E.dirty++;
+}
+
+/* replaces del bytes at at with the len bytes at s */
+void editorRowSplice(erow* row, int at, int del, const char* s, int len) {
+	if (at < 0 || del < 0 || at + del > row->size) return;
+
+	if (row == G.row || row->size - del + len >= ROW_LONG) {
+		editorGapOpen(row, at, len);
+		editorEditRecord(EDIT_SPLICE, editorRowIndex(row), at, &row->chars[G.at + G.len], del, s, len);
+		G.len += del;
+		if (len) memcpy(&row->chars[G.at], s, len);
+		G.at += len;
+		G.len -= len;
+		row->size += len - del;
+		editorUpdateRow(row, at, del, len);
+		++E.dirty;
+		return;
+	}
+
+	editorEditRecord(EDIT_SPLICE, editorRowIndex(row), at, &editorRowText(row)[at], del, s, len);
+	editorRowMaterialize(row);
+	if (len > del) {
+		editorRowReserve(row, row->size - del + len + 1);
+	}
+	memmove(&row->chars[at + len], &row->chars[at + del], row->size - at - del + 1);
+	if (len) memcpy(&row->chars[at], s, len);
+	row->size += len - del;
+	editorUpdateRow(row, at, del, len);
 	++E.dirty;
 }
 
-void editorRowAppendString(erow* row, char* s, size_t len) {
-	row->chars = realloc(row->chars, row->size + len + 1);
-	memcpy(&row->chars[row->size], s, len);
-	row->size += len;
-	row->chars[row->size] = '\0';
-	editorUpdateRow(row);
+/* editor operations func realization */
+void editorInsertChar(int c) {
+	if (E.cursor_y == E.numrows) {
+		editorInsertRow(E.numrows, "", 0);
+	}
+
+	editorRowInsertChar(editorRowAt(E.cursor_y), E.cursor_x, c);
+	E.cursor_x++;
+}
+
+void editorInsertNewline() {
+	if (E.cursor_x == 0) {
+		editorInsertRow(E.cursor_y, "", 0);
+	}
+	else {
+		erow* row = editorRowAt(E.cursor_y);
+		editorInsertRow(E.cursor_y + 1, &editorRowText(row)[E.cursor_x], row->size - E.cursor_x);
+		editorRowSplice(row, E.cursor_x, row->size - E.cursor_x, NULL, 0);
+	}
+
+	++E.cursor_y;
+	E.cursor_x = 0;
+}
+
+void editorDelChar() {
+	if (E.cursor_y == E.numrows) return;
+	if (E.cursor_x == 0 && E.cursor_y == 0) return;
+
+	erow* row = editorRowAt(E.cursor_y);
+	if (E.cursor_x > 0) {
+		editorRowDelChar(row, E.cursor_x - 1);
+		--E.cursor_x;
+	}
+	else {
+		erow* prev = editorRowPrev(row);
+		E.cursor_x = prev->size;
+		editorRowAppendString(prev, editorRowText(row), row->size);
+		editorDelRow(E.cursor_y);
+		--E.cursor_y;
+	}
+}
+
+/* inserts text that may span lines at the cursor. The row at the cursor
+ * takes the first line, the following lines become rows of their own and
+ * the last one takes the rest of the row; highlighting is settled once
+ * for all of them */
+void editorInsertText(const char* text, size_t len) {
+	if (len == 0) return;
+	if (E.cursor_y == E.numrows) {
+		editorInsertRow(E.numrows, "", 0);
+	}
+
+	E.hl_batch = 1;
+	erow* row = editorRowAt(E.cursor_y);
+	size_t line = 0;
+	while (line < len && text[line] != '\n' && text[line] != '\r') ++line;
+
+	if (line == len) {
+		editorRowSplice(row, E.cursor_x, 0, text, len);
+		E.cursor_x += len;
+	}
+	else {
+		int tail_len = row->size - E.cursor_x;
+		char* tail = malloc(tail_len + 1);
+		if (tail == NULL) {
+			quit_error("malloc error in editorInsertText");
+		}
+		memcpy(tail, &editorRowText(row)[E.cursor_x], tail_len);
+		editorRowSplice(row, E.cursor_x, tail_len, text, line);
+
+		int at = E.cursor_y;
+		size_t pos = line;
+		while (pos < len) {
+			pos += (text[pos] == '\r' && pos + 1 < len && text[pos + 1] == '\n') ? 2 : 1;
+			size_t end = pos;
+			while (end < len && text[end] != '\n' && text[end] != '\r') ++end;
+
+			++at;
+			if (end < len) {
+				editorInsertRow(at, (char*)&text[pos], end - pos);
+			}
+			else {
+				char* last = malloc(end - pos + tail_len + 1);
+				if (last == NULL) {
+					quit_error("malloc error in editorInsertText");
+				}
+				memcpy(last, &text[pos], end - pos);
+				memcpy(&last[end - pos], tail, tail_len);
+				editorInsertRow(at, last, end - pos + tail_len);
+				free(last);
+				E.cursor_x = end - pos;
+			}
+			pos = end;
+		}
+		free(tail);
+		E.cursor_y = at;
+	}
+
+	E.hl_batch = 0;
+	editorSyntaxSettle(E.cursor_y + E.screenrows, HL_SYNC_BUDGET);
+}
+
+/* takes the text of a bracketed paste off the input and inserts it in one
+ * go, so it is drawn once and undone as one step */
+void editorPaste() {
+	static const char end[] = "\x1b[201~";
+	size_t len = 0, cap = 4096;
+	char* text = malloc(cap);
+	if (text == NULL) {
+		quit_error("malloc error in editorPaste");
+	}
+	int stalled = 0;
+
+	while (len < sizeof(end) - 1 || memcmp(&text[len - (sizeof(end) - 1)], end, sizeof(end) - 1) != 0) {
+		char c;
+		if (!editorInputByte(&c)) {
+			if (++stalled == PASTE_TIMEOUT_TICKS) break;
+			continue;
+		}
+		stalled = 0;
+		if (len == cap) {
+			cap *= 2;
+			text = realloc(text, cap);
+			if (text == NULL) {
+				quit_error("realloc error in editorPaste");
+			}
+		}
+		text[len++] = c;
+	}
+	if (stalled < PASTE_TIMEOUT_TICKS) {
+		len -= sizeof(end) - 1;
+	}
+
+	editorInsertText(text, len);
+	free(text);
+}
+
+/* when more plain keys than c are already waiting, inserts them all with c
+ * as text and returns 1 */
+int editorTypeAhead(int c) {
+	if (IN.head == IN.tail || c > 255 || ((unsigned char)c < 32 && c != '\t')) return 0;
+
+	unsigned int end = IN.head;
+	while (end != IN.tail) {
+		unsigned char next = IN.buf[end & (INPUT_RING - 1)];
+		if ((next < 32 && next != '\t' && next != '\r') || next == 127) break;
+		++end;
+	}
+	if (end == IN.head) return 0;
+
+	char* text = malloc(end - IN.head + 1);
+	size_t len = 0;
+	text[len++] = c;
+	while (IN.head != end) {
+		text[len++] = IN.buf[IN.head++ & (INPUT_RING - 1)];
+	}
+	editorInsertText(text, len);
+	free(text);
+
+	return 1;
+}
+
+/* file input/output func realization */
+void editorOpen(char* filename) {
+	free(E.filename);
+	E.filename = strdup(filename);
+
+	editorSelectSyntaxHighlight();
+
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1) {
+		quit_error("error opening file; editorOpen func");
+	}
+
+	/* regular files are mapped and split into rows that keep pointing into
+	 * the mapping, text is only copied out for rows that get shown or edited */
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		char* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			close(fd);
+			E.map = map;
+			E.map_size = st.st_size;
+
+			pthread_mutex_init(&LD.lock, NULL);
+			pthread_cond_init(&LD.ready, NULL);
+			pthread_cond_init(&LD.room, NULL);
+			for (int k = 0; k < LOAD_QUEUE; ++k) {
+				LD.batches[k] = malloc(sizeof(loadRow) * LOAD_BATCH_ROWS);
+				if (LD.batches[k] == NULL) {
+					quit_error("malloc error in editorOpen");
+				}
+			}
+			LD.handed = 0;
+			LD.taken = 0;
+			LD.done = 0;
+			LD.scanned = 0;
+			LD.reported = -1;
+			clock_gettime(CLOCK_MONOTONIC, &LD.start);
+			LD.active = pthread_create(&LD.thread, NULL, editorLoadReader, NULL) == 0;
+
+			if (LD.active) {
+				editorLoadTake(1); //the first frame has rows to show
+			}
+			else {
+				size_t pos = 0;
+				while (pos < E.map_size) {
+					int n;
+					pos = editorLoadSplit(pos, LD.batches[0], &n);
+					for (int i = 0; i < n; ++i) {
+						editorInsertMappedRow(E.numrows, LD.batches[0][i].src, LD.batches[0][i].len);
+					}
+				}
+				for (int k = 0; k < LOAD_QUEUE; ++k) {
+					free(LD.batches[k]);
+					LD.batches[k] = NULL;
+				}
+			}
+			E.dirty = 0;
+			editorJournalOpen();
+			return;
+		}
+	}
+
+	FILE* fp = fdopen(fd, "r");
+	if (!fp) {
+		quit_error("error opening file; editorOpen func");
+	}
+	char* line = NULL;
+	size_t linecap = 0;
+	ssize_t linelen;
+	U.applying = 1; //the lines read are the buffer to start from, not edits to undo
+	while ((linelen = getline(&line, &linecap, fp)) != -1) {
+		while (linelen > 0 && (line[linelen - 1] == '\n' ||
+							line[linelen - 1] == '\r')) {
+			--linelen;
+		}
+		editorInsertRow(E.numrows, line, linelen);
+	}
+	U.applying = 0;
+	U.head = U.count = U.cur = 0;
+	U.can_merge = 0;
+	free(line);
+	fclose(fp);
+	E.dirty = 0;
+	editorJournalOpen();
+}
+
+/* splits up to LOAD_BATCH_ROWS lines off the map from pos on, leaving out
+ * the \r of a \r\n line break; returns where the next line starts */
+size_t editorLoadSplit(size_t pos, loadRow* rows, int* n) {
+	*n = 0;
+	while (*n < LOAD_BATCH_ROWS && pos < E.map_size) {
+		char* nl = memchr(&E.map[pos], '\n', E.map_size - pos);
+		size_t end = nl ? (size_t)(nl - E.map) : E.map_size;
+		size_t len = end - pos;
+		while (len > 0 && E.map[pos + len - 1] == '\r') {
+			--len;
+		}
+		rows[*n].src = pos;
+		rows[*n].len = len;
+		++*n;
+		pos = end + 1;
+	}
+
+	return pos;
+}
+
+void* editorLoadReader(void* arg) {
+	(void)arg;
+	size_t pos = 0;
+
+	while (pos < E.map_size) {
+		pthread_mutex_lock(&LD.lock);
+		while (LD.handed - LD.taken == LOAD_QUEUE) {
+			pthread_cond_wait(&LD.room, &LD.lock);
+		}
+		int slot = LD.handed % LOAD_QUEUE;
+		pthread_mutex_unlock(&LD.lock);
+
+		int n;
+		pos = editorLoadSplit(pos, LD.batches[slot], &n);
+
+		pthread_mutex_lock(&LD.lock);
+		LD.counts[slot] = n;
+		++LD.handed;
+		LD.scanned = pos < E.map_size ? pos : E.map_size;
+		LD.done = pos >= E.map_size;
+		pthread_cond_signal(&LD.ready);
+		pthread_mutex_unlock(&LD.lock);
+		editorEventWake();
+	}
+
+	return NULL;
+}
+
+/* appends the next batch the reader handed over, waiting for one if wait
+ * is set; returns 0 once there is none */
+int editorLoadTake(int wait) {
+	pthread_mutex_lock(&LD.lock);
+	while (wait && LD.taken == LD.handed && !LD.done) {
+		pthread_cond_wait(&LD.ready, &LD.lock);
+	}
+	int slot = LD.taken % LOAD_QUEUE;
+	int n = LD.taken < LD.handed ? LD.counts[slot] : -1;
+	pthread_mutex_unlock(&LD.lock);
+	if (n == -1) return 0;
+
+	loadRow* rows = LD.batches[slot];
+	for (int i = 0; i < n; ++i) {
+		editorInsertMappedRow(E.numrows, rows[i].src, rows[i].len);
+	}
+
+	pthread_mutex_lock(&LD.lock);
+	++LD.taken;
+	pthread_cond_signal(&LD.room);
+	pthread_mutex_unlock(&LD.lock);
+
+	return 1;
+}
+
+/* appends the rows the reader has handed over, giving way to input; with
+ * wait it returns only once the whole file is in. Reports the progress and
+ * reaps the reader at the end. Returns 1 if the screen has to be drawn again */
+int editorLoadPoll(int wait) {
+	if (!LD.active) return 0;
+
+	/* without wait at most a queue's worth goes in, so frames showing the
+	 * progress get drawn in between. Keys held back for a search may wait
+	 * on rows still to come, so they do not stop the loading. Search workers
+	 * keep out of the tree while it grows: they take no new range once rows
+	 * are waiting, and the rows go in on a later poll if one is still in the
+	 * middle of a range, rather than waiting for it here */
+	pthread_mutex_lock(&LD.lock);
+	int ready = LD.taken < LD.handed;
+	pthread_mutex_unlock(&LD.lock);
+
+	int added = 0;
+	if (wait || ready) {
+		if (!editorSearchPause(wait)) return 0; //tried again once the workers are out
+		while (wait ? editorLoadTake(1) : added < LOAD_QUEUE && (SE.pending || !editorEventKeyReady()) &&
+				editorLoadTake(0)) {
+			++added;
+		}
+	}
+
+	pthread_mutex_lock(&LD.lock);
+	int finished = LD.done && LD.taken == LD.handed;
+	size_t scanned = LD.scanned;
+	pthread_mutex_unlock(&LD.lock);
+
+	if (finished) {
+		pthread_join(LD.thread, NULL);
+		LD.active = 0;
+		for (int k = 0; k < LOAD_QUEUE; ++k) {
+			free(LD.batches[k]);
+			LD.batches[k] = NULL;
+		}
+	}
+	editorSearchResume();
+
+	if (finished) {
+		if (LD.reported == -1) return added > 0; //too quick to report on
+
+		struct timespec end;
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		editorSetStatusMessage("%d lines loaded in %.0f ms", E.numrows,
+				(end.tv_sec - LD.start.tv_sec) * 1000 + (end.tv_nsec - LD.start.tv_nsec) / 1e6);
+		return 1;
+	}
+
+	int percent = scanned * 100 / E.map_size;
+	if (percent != LD.reported) {
+		LD.reported = percent;
+		editorSetStatusMessage("Loading... %d%% (%d lines)", percent, E.numrows);
+		return 1;
+	}
+
+	return added > 0; //the line count on the status bar went up
+}
+
+/* writes all of iov, picking up after short writes */
+int editorWritev(int fd, struct iovec* iov, int cnt) {
+	while (cnt > 0) {
+		ssize_t n = writev(fd, iov, cnt);
+		if (n == -1) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+
+		while (cnt > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			++iov;
+			--cnt;
+		}
+		if (cnt > 0) {
+			iov->iov_base = (char*)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+
+	return 0;
+}
+
+/* writes all of len bytes at p to offset off, picking up after short writes */
+int editorPwrite(int fd, const char* p, size_t len, size_t off) {
+	while (len > 0) {
+		ssize_t n = pwrite(fd, p, len, off);
+		if (n == -1) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		p += n;
+		len -= n;
+		off += n;
+	}
+
+	return 0;
+}
+
+/* writes the batch and counts it towards the progress of the save */
+int editorSaveFlush(int fd, saveBatch* batch) {
+	if (editorWritev(fd, batch->iov, batch->cnt) == -1) return -1;
+
+	__atomic_add_fetch(&SV.written, batch->bytes, __ATOMIC_RELAXED);
+	editorEventWake(); //for the progress report
+	batch->cnt = 0;
+	batch->bytes = 0;
+
+	return 0;
+}
+
+/* adds len bytes at p to the batch and writes it out whenever it fills up;
+ * long stretches are cut so that no writev goes past SAVE_BATCH_BYTES */
+int editorSaveQueue(int fd, saveBatch* batch, const char* p, size_t len) {
+	while (len > 0) {
+		size_t n = SAVE_BATCH_BYTES - batch->bytes;
+		if (n > len) n = len;
+
+		struct iovec* last = batch->cnt ? &batch->iov[batch->cnt - 1] : NULL;
+		if (last && (char*)last->iov_base + last->iov_len == p) {
+			last->iov_len += n;
+		}
+		else {
+			batch->iov[batch->cnt].iov_base = (char*)p;
+			batch->iov[batch->cnt].iov_len = n;
+			++batch->cnt;
+		}
+		batch->bytes += n;
+		p += n;
+		len -= n;
+
+		if (batch->cnt == SAVE_IOV_BATCH || batch->bytes == SAVE_BATCH_BYTES) {
+			if (editorSaveFlush(fd, batch) == -1) return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* turns the rows into SV.pieces. A row still in the map that is followed
+ * there by its own line break takes it along, so rows back to back in the
+ * map join into one piece; rows with chars of their own are marked shared */
+void editorSaveSnapshot() {
+	SV.num_pieces = 0;
+	SV.total = 0;
+
+	for (erow* row = editorRowAt(0); row; row = editorRowNext(row)) {
+		const char* text = editorRowText(row);
+		size_t len = row->size;
+		int newline = 1;
+		row->flags &= ~ROW_HELD; //left over from an earlier save
+		if (row->chars) {
+			row->flags |= ROW_SHARED;
+		}
+		else if (row->data.src + row->size < E.map_size && E.map[row->data.src + row->size] == '\n') {
+			++len;
+			newline = 0;
+		}
+		SV.total += row->size + 1;
+
+		savePiece* last = SV.num_pieces ? &SV.pieces[SV.num_pieces - 1] : NULL;
+		if (last && !last->newline && last->text + last->len == text) {
+			last->len += len;
+			last->newline = newline;
+			continue;
+		}
+
+		if (SV.num_pieces == SV.pieces_cap) {
+			SV.pieces_cap = SV.pieces_cap ? SV.pieces_cap * 2 : 64;
+			SV.pieces = realloc(SV.pieces, sizeof(savePiece) * SV.pieces_cap);
+		}
+		SV.pieces[SV.num_pieces].text = text;
+		SV.pieces[SV.num_pieces].len = len;
+		SV.pieces[SV.num_pieces].newline = newline;
+		++SV.num_pieces;
+	}
+}
+
+/* makes the temp file that will replace the file, next to it and with the
+ * mode and owner of the old one, and keeps it in SV. Returns 1 without
+ * touching anything if the file has to be rewritten in place instead: no
+ * temp file can be made in its directory, it is not a regular file, it has
+ * other hard links that a rename would leave behind, or its owner cannot be
+ * kept */
+int editorSaveTemp(const char* filename) {
+	/* a symlink is saved through to the file it points at */
+	struct stat st;
+	char* path = realpath(filename, NULL);
+	int exists = path && stat(path, &st) == 0;
+	if (!exists) {
+		free(path);
+		path = strdup(filename);
+	}
+	else if (!S_ISREG(st.st_mode) || st.st_nlink > 1) {
+		free(path);
+		return 1;
+	}
+
+	char* slash = strrchr(path, '/');
+	int dirlen = slash ? slash - path + 1 : 0;
+	char* tmp = malloc(strlen(path) + 16);
+	sprintf(tmp, "%.*s.%s.XXXXXX", dirlen, path, path + dirlen);
+	int fd = mkstemp(tmp);
+	if (fd == -1) {
+		free(tmp);
+		free(path);
+		return 1;
+	}
+
+	int result = -1;
+	struct stat tst;
+	if (exists) {
+		if (fstat(fd, &tst) == 0 && (tst.st_uid != st.st_uid || tst.st_gid != st.st_gid) &&
+				fchown(fd, st.st_uid, st.st_gid) == -1) {
+			result = 1;
+			goto fail;
+		}
+		if (fchmod(fd, st.st_mode & 07777) == -1) goto fail;
+	}
+	else {
+		mode_t mask = umask(0);
+		umask(mask);
+		if (fchmod(fd, 0666 & ~mask) == -1) goto fail;
+	}
+
+	SV.path = path;
+	SV.tmp = tmp;
+	SV.fd = fd;
+
+	return 0;
+
+fail:
+	{
+		int err = errno;
+		close(fd);
+		unlink(tmp);
+		free(tmp);
+		free(path);
+		errno = err;
+	}
+
+	return result;
+}
+
+/* writer thread: streams the snapshot into the temp file, then syncs it and
+ * renames it over the file, so a crash leaves either the old file or the
+ * new one */
+void* editorSaveWriter(void* arg) {
+	(void)arg;
+	saveBatch batch;
+	batch.cnt = 0;
+	batch.bytes = 0;
+
+	int failed = 0;
+	for (int i = 0; i < SV.num_pieces && !failed; ++i) {
+		savePiece* piece = &SV.pieces[i];
+		failed = editorSaveQueue(SV.fd, &batch, piece->text, piece->len) == -1 ||
+			(piece->newline && editorSaveQueue(SV.fd, &batch, "\n", 1) == -1);
+	}
+	if (!failed) {
+		failed = (batch.cnt && editorSaveFlush(SV.fd, &batch) == -1) ||
+			fsync(SV.fd) == -1 || rename(SV.tmp, SV.path) == -1;
+	}
+
+	if (failed) {
+		SV.error = errno;
+		unlink(SV.tmp);
+	}
+	else {
+		/* the rename itself is only durable once the directory is synced */
+		char* slash = strrchr(SV.path, '/');
+		char* dir = slash ? strndup(SV.path, slash - SV.path + 1) : strdup(".");
+		int dirfd = open(dir, O_RDONLY);
+		if (dirfd != -1) {
+			fsync(dirfd);
+			close(dirfd);
+		}
+		free(dir);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &SV.end);
+
+	__atomic_store_n(&SV.done, 1, __ATOMIC_RELEASE);
+	editorEventWake();
+
+	return NULL;
+}
+
+/* whether the piece, which the file will hold at out, is text in the map
+ * that ends up further on than it is now */
+int editorSavePieceMoved(savePiece* piece, size_t out) {
+	if (E.map == NULL || E.map_heap) return 0;
+	if (piece->text < E.map || piece->text >= E.map + E.map_size) return 0;
+
+	return out > (size_t)(piece->text - E.map);
+}
+
+/* writes the pieces that move further on, back to front, so each lands only
+ * on text that was read already; buf gets filled from its end */
+int editorSaveMoved(int fd, char* buf) {
+	size_t out = SV.total;
+	size_t fill = 0;
+	size_t at = 0; //where the fill bytes at the end of buf go
+
+	for (int i = SV.num_pieces - 1; i >= 0; --i) {
+		savePiece* piece = &SV.pieces[i];
+		out -= piece->len + piece->newline;
+		if (!editorSavePieceMoved(piece, out)) continue;
+
+		size_t end = piece->len;
+		while (end > 0) {
+			if (fill && at != out + end) {
+				if (editorPwrite(fd, buf + SAVE_BATCH_BYTES - fill, fill, at) == -1) return -1;
+				fill = 0;
+			}
+			size_t n = SAVE_BATCH_BYTES - fill < end ? SAVE_BATCH_BYTES - fill : end;
+			memcpy(buf + SAVE_BATCH_BYTES - fill - n, piece->text + end - n, n);
+			fill += n;
+			end -= n;
+			at = out + end;
+			if (fill == SAVE_BATCH_BYTES) {
+				if (editorPwrite(fd, buf, fill, at) == -1) return -1;
+				fill = 0;
+			}
+		}
+	}
+
+	return fill ? editorPwrite(fd, buf + SAVE_BATCH_BYTES - fill, fill, at) : 0;
+}
+
+/* copies len bytes at p, which go to offset off, after the fill bytes in
+ * buf that go to at, writing buf out whenever it fills up or the bytes go
+ * somewhere else */
+int editorSaveCopy(int fd, char* buf, size_t* fill, size_t* at, const char* p, size_t len, size_t off) {
+	while (len > 0) {
+		if (*fill && *at + *fill != off) {
+			if (editorPwrite(fd, buf, *fill, *at) == -1) return -1;
+			*fill = 0;
+		}
+		if (*fill == 0) *at = off;
+
+		size_t n = SAVE_BATCH_BYTES - *fill < len ? SAVE_BATCH_BYTES - *fill : len;
+		memcpy(buf + *fill, p, n);
+		*fill += n;
+		p += n;
+		off += n;
+		len -= n;
+		if (*fill == SAVE_BATCH_BYTES) {
+			if (editorPwrite(fd, buf, *fill, *at) == -1) return -1;
+			*fill = 0;
+		}
+	}
+
+	return 0;
+}
+
+/* writes the rest front to back: text in the map that stays where it is or
+ * moves towards the start, rows with text of their own and line breaks */
+int editorSaveStayed(int fd, char* buf) {
+	size_t out = 0;
+	size_t fill = 0;
+	size_t at = 0;
+
+	for (int i = 0; i < SV.num_pieces; ++i) {
+		savePiece* piece = &SV.pieces[i];
+		if (!editorSavePieceMoved(piece, out) &&
+				editorSaveCopy(fd, buf, &fill, &at, piece->text, piece->len, out) == -1) return -1;
+		if (piece->newline && editorSaveCopy(fd, buf, &fill, &at, "\n", 1, out + piece->len) == -1) return -1;
+		out += piece->len + piece->newline;
+	}
+
+	return fill ? editorPwrite(fd, buf, fill, at) : 0;
+}
+
+/* rewrites the file through its own descriptor, a batch at a time. Rows
+ * still in the map read this very file, so no batch may land on text that
+ * is yet to be read: rows keep their order in the map, so the pieces that
+ * move further on are written back to front first and the rest front to
+ * back after. Each batch is copied out before its write, a piece can
+ * overlap where it goes. The file is cut to length only at the end, the map
+ * must not lose text that is still to be read */
+int editorSaveInPlace(const char* filename, size_t* written) {
+	editorSaveSnapshot();
+
+	int fd = open(filename, O_RDWR | O_CREAT, 0644);
+	if (fd == -1) return -1;
+
+	char* buf = malloc(SAVE_BATCH_BYTES);
+	if (buf == NULL) {
+		quit_error("malloc error in editorSaveInPlace");
+	}
+	int failed = editorSaveMoved(fd, buf) == -1 || editorSaveStayed(fd, buf) == -1 ||
+		ftruncate(fd, SV.total) == -1 || fsync(fd) == -1;
+	free(buf);
+	if (failed) {
+		int err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+
+	/* the map shows the new text now, rows that still point into it have to
+	 * follow it; if it cannot be mapped they get a copy */
+	if (E.map) {
+		char* map = SV.total ? mmap(NULL, SV.total, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+		if (map != MAP_FAILED) {
+			editorRebaseRows(map, SV.total, 0);
+		}
+		else {
+			char* copy = malloc(SV.total + 1);
+			if (copy == NULL) {
+				quit_error("malloc error in editorSaveInPlace");
+			}
+			size_t got = 0;
+			while (got < SV.total) {
+				ssize_t n = pread(fd, copy + got, SV.total - got, got);
+				if (n <= 0 && !(n == -1 && errno == EINTR)) {
+					quit_error("error reading back the file; editorSaveInPlace func");
+				}
+				if (n > 0) got += n;
+			}
+			editorRebaseRows(copy, SV.total, 1);
+		}
+	}
+	close(fd);
+	*written = SV.total;
+
+	return 0;
+}
+
+/* keeps memory the writer may still read until it is done */
+void editorSaveOrphan(void* p, slab* from) {
+	if (SV.num_orphans == SV.orphans_cap) {
+		SV.orphans_cap = SV.orphans_cap ? SV.orphans_cap * 2 : 64;
+		SV.orphans = realloc(SV.orphans, sizeof(saveOrphan) * SV.orphans_cap);
+	}
+	SV.orphans[SV.num_orphans].p = p;
+	SV.orphans[SV.num_orphans++].from = from;
+}
+
+void editorSaveReport(size_t len, struct timespec* start, struct timespec* end) {
+	double secs = (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+
+	editorSetStatusMessage("%zu bytes written to disk in %.0f ms, %.1f MB/s%s", len, secs * 1000,
+			secs > 0 ? len / secs / (1 << 20) : 0.0, E.dirty ? ", edited since" : "");
+}
+
+/* reports the progress of a running save, or reaps it once the writer is
+ * done; with wait it blocks until then. Returns 1 if the status changed */
+int editorSavePoll(int wait) {
+	if (!SV.active) return 0;
+
+	if (!wait && !__atomic_load_n(&SV.done, __ATOMIC_ACQUIRE)) {
+		size_t written = __atomic_load_n(&SV.written, __ATOMIC_RELAXED);
+		if (written == SV.reported) return 0;
+
+		SV.reported = written;
+		editorSetStatusMessage("Saving... %d%% (%zu of %zu bytes)",
+				(int)(written * 100 / (SV.total ? SV.total : 1)), written, SV.total);
+		return 1;
+	}
+
+	if (SV.thread_started) {
+		pthread_join(SV.thread, NULL);
+	}
+	SV.active = 0;
+	for (int i = 0; i < SV.num_orphans; ++i) {
+		if (SV.orphans[i].from) {
+			slabFree(SV.orphans[i].from, SV.orphans[i].p);
+		}
+		else {
+			free(SV.orphans[i].p);
+		}
+	}
+	SV.num_orphans = 0;
+
+	if (SV.error == 0) {
+		/* rows follow the text to the new file unless they were edited since
+		 * the snapshot and no longer match it, the old text stays valid */
+		if (E.dirty == SV.dirty) {
+			char* map = E.map && SV.total ? mmap(NULL, SV.total, PROT_READ, MAP_PRIVATE, SV.fd, 0) : MAP_FAILED;
+			if (map != MAP_FAILED) {
+				/* search workers read the old map while the prompt is open,
+				 * or an Enter there waits for the first match; editorSearchStop
+				 * rebases once they are out */
+				SV.rebase = map;
+				SV.rebase_size = SV.total;
+				if (!SE.active && !SE.pending) {
+					editorSaveRebase();
+				}
+			}
+			E.dirty = 0;
+		}
+		editorJournalRebase(SV.journal_mark);
+		editorSaveReport(SV.total, &SV.start, &SV.end);
+	}
+	else {
+		editorSetStatusMessage("Cant save! I/O error: %s", strerror(SV.error));
+	}
+
+	close(SV.fd);
+	free(SV.path);
+	free(SV.tmp);
+
+	return 1;
+}
+
+void editorSave() {
+	if (SV.active) {
+		editorSetStatusMessage("Still saving, try again once it is done");
+		return;
+	}
+	editorLoadPoll(1); //the snapshot takes the whole file
+
+	if (E.filename == NULL) {
+		E.filename = editorPrompt("Save as: %s (ESC to cancel)", NULL, 0);
+		if (E.filename == NULL) {
+			editorSetStatusMessage("Save aborted!");
+			return;
+		}
+		editorSelectSyntaxHighlight();
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	int result = editorSaveTemp(E.filename);
+	if (result == 0) {
+		editorSaveSnapshot();
+		SV.start = start;
+		SV.dirty = E.dirty;
+		SV.journal_mark = J.logged;
+		SV.written = 0;
+		SV.reported = (size_t)-1; //so the first poll reports
+		SV.done = 0;
+		SV.error = 0;
+		SV.active = 1;
+		SV.thread_started = pthread_create(&SV.thread, NULL, editorSaveWriter, NULL) == 0;
+		if (!SV.thread_started) {
+			editorSaveWriter(NULL);
+		}
+		editorSavePoll(0);
+		return;
+	}
+
+	size_t len = 0;
+	if (result == 1) {
+		result = editorSaveInPlace(E.filename, &len);
+	}
+	if (result == -1) {
+		editorSetStatusMessage("Cant save! I/O error: %s", strerror(errno));
+		return;
+	}
+
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	E.dirty = 0;
+	editorJournalRebase(J.logged);
+	editorSaveReport(len, &start, &end);
+}
+
+void editorRebaseRows(char* base, size_t size, int heap) {
+	while (E.num_cached) {
+		editorRowDropCache(E.cached_rows[0]); //render may be the text in the old map
+	}
+
+	if (E.map) {
+		if (E.map_heap) {
+			free(E.map);
+		}
+		else {
+			munmap(E.map, E.map_size);
+		}
+	}
+
+	size_t off = 0;
+	for (erow* row = editorRowAt(0); row; row = editorRowNext(row)) {
+		if (row->chars == NULL) {
+			row->data.src = off;
+		}
+		off += row->size + 1;
+	}
+
+	E.map = base;
+	E.map_size = size;
+	E.map_heap = heap;
+}
+
+/* moves the rows onto the mapping a finished save left in SV.rebase, unless
+ * they were edited since and no longer match it */
+void editorSaveRebase() {
+	if (SV.rebase == NULL) return;
+
+	if (E.dirty == 0) {
+		editorRebaseRows(SV.rebase, SV.rebase_size, 0);
+	}
+	else {
+		munmap(SV.rebase, SV.rebase_size);
+	}
+	SV.rebase = NULL;
+}
+
+/* undo func realization */
+/* every row operation reports itself here before it changes the buffer:
+ * removed holds the del bytes it takes out, text the len bytes it puts in */
+void editorEditRecord(int op, int row, int col, const char* removed, int del, const char* text, int len) {
+	editorJournalRecord(op, row, col, del, text, len);
+	editorUndoRecord(op, row, col, removed, del, text, len);
+}
+
+undoRec* undoAt(int i) {
+	return &U.recs[(U.head + i) % U.cap];
+}
+
+/* drops the oldest step */
+void undoDropOldest() {
+	int group = undoAt(0)->group;
+	while (U.count > 0 && undoAt(0)->group == group) {
+		U.head = (U.head + 1) % U.cap;
+		--U.count;
+		--U.cur;
+	}
+	U.bstart = U.count ? undoAt(0)->at : U.bend;
+}
+
+/* forgets the records from n on, what could be redone */
+void undoTruncate(int n) {
+	if (n < U.count) {
+		U.bend = undoAt(n)->at;
+		U.count = n;
+	}
+	if (U.cur > U.count) {
+		U.cur = U.count;
+	}
+}
+
+/* finds room for n bytes after the newest ones, going round to the start
+ * of the ring when the end is too short; returns 0 if there is none */
+int undoAlloc(size_t n, size_t* at) {
+	size_t cap = CTRLC_UNDO_MEM / 2;
+	if (U.bytes == NULL) {
+		U.bytes = malloc(cap);
+		if (U.bytes == NULL) {
+			quit_error("malloc error in undoAlloc");
+		}
+	}
+	if (U.count == 0) {
+		U.bstart = U.bend = 0;
+	}
+
+	if (U.bend >= U.bstart && n <= cap - U.bend) {
+		*at = U.bend;
+	}
+	else if (U.bend >= U.bstart && n < U.bstart) {
+		*at = 0;
+	}
+	else if (U.bend < U.bstart && n < U.bstart - U.bend) {
+		*at = U.bend;
+	}
+	else {
+		return 0;
+	}
+	U.bend = *at + n;
+
+	return 1;
+}
+
+/* extends the last record when the edit goes on where it ended: typing
+ * further along the row, or deleting more with Backspace or Delete */
+int undoMerge(int op, int row, int col, const char* removed, int del, const char* text, int len) {
+	if (!U.can_merge || U.count == 0 || op != EDIT_SPLICE) return 0;
+
+	undoRec* last = undoAt(U.count - 1);
+	if (last->op != EDIT_SPLICE || last->row != row) return 0;
+
+	int typing = del == 0 && len == 1 && last->del == 0 && last->col + last->len == col;
+	int deleting = len == 0 && del == 1 && last->len == 0 && (last->col == col || last->col == col + 1);
+	if (!typing && !deleting) return 0;
+
+	/* the bytes of the last record end at bend, so there has to be room
+	 * for one more right behind them */
+	size_t cap = CTRLC_UNDO_MEM / 2;
+	if (U.bend >= U.bstart ? U.bend + 1 > cap : U.bend + 1 >= U.bstart) return 0;
+
+	char* bytes = &U.bytes[last->at];
+	if (typing) {
+		bytes[last->len++] = text[0];
+	}
+	else if (last->col == col) {
+		bytes[last->del++] = removed[0];
+	}
+	else {
+		memmove(&bytes[1], bytes, last->del++);
+		bytes[0] = removed[0];
+		last->col = col;
+	}
+	++U.bend;
+
+	return 1;
+}
+
+void editorUndoRecord(int op, int row, int col, const char* removed, int del, const char* text, int len) {
+	if (U.applying) return;
+
+	/* a new edit ends what could be redone */
+	undoTruncate(U.cur);
+
+	if (undoMerge(op, row, col, removed, del, text, len)) return;
+
+	if (U.sealed) {
+		U.sealed = 0;
+		++U.group;
+	}
+	if (U.group == U.lost_group) return;
+
+	size_t at;
+	int max_recs = CTRLC_UNDO_MEM / 2 / sizeof(undoRec);
+	while (U.count == max_recs || !undoAlloc(del + len, &at)) {
+		/* a single step larger than the budget cannot be undone */
+		if (U.count == 0 || undoAt(0)->group == U.group) {
+			U.head = U.count = U.cur = 0;
+			U.lost_group = U.group;
+			U.can_merge = 0;
+			editorSetStatusMessage("This change is too large to be undone");
+			return;
+		}
+		undoDropOldest();
+	}
+
+	if (U.count == U.cap) {
+		int cap = U.cap ? U.cap * 2 : 256;
+		undoRec* recs = malloc(sizeof(undoRec) * cap);
+		if (recs == NULL) {
+			quit_error("malloc error in editorUndoRecord");
+		}
+		for (int i = 0; i < U.count; ++i) {
+			recs[i] = *undoAt(i);
+		}
+		free(U.recs);
+		U.recs = recs;
+		U.cap = cap;
+		U.head = 0;
+	}
+
+	undoRec* rec = undoAt(U.count++);
+	rec->op = op;
+	rec->group = U.group;
+	rec->row = row;
+	rec->col = col;
+	rec->del = del;
+	rec->len = len;
+	rec->at = at;
+	if (del) memcpy(&U.bytes[at], removed, del);
+	if (len) memcpy(&U.bytes[at + del], text, len);
+	U.cur = U.count;
+	U.can_merge = 1;
+}
+
+/* called before each command, whose edits then make up one step */
+void editorUndoBoundary() {
+	U.sealed = 1;
+}
+
+/* applies a record, or with undo its inverse, and leaves the cursor where
+ * the change is */
+void editorUndoApply(undoRec* rec, int undo) {
+	char* removed = &U.bytes[rec->at];
+	char* text = &U.bytes[rec->at + rec->del];
+	int insert_row = (rec->op == EDIT_INSERT_ROW) != undo;
+
+	if (rec->op == EDIT_SPLICE) {
+		erow* row = editorRowAt(rec->row);
+		if (row == NULL) return;
+		if (undo) {
+			editorRowSplice(row, rec->col, rec->len, removed, rec->del);
+		}
+		else {
+			editorRowSplice(row, rec->col, rec->del, text, rec->len);
+		}
+		E.cursor_x = rec->col + (undo ? 0 : rec->len);
+	}
+	else if (insert_row) {
+		if (rec->op == EDIT_INSERT_ROW) {
+			editorInsertRow(rec->row, text, rec->len);
+		}
+		else {
+			editorInsertRow(rec->row, removed, rec->del);
+		}
+		E.cursor_x = 0;
+	}
+	else {
+		editorDelRow(rec->row);
+		E.cursor_x = 0;
+	}
+	E.cursor_y = rec->row;
+}
+
+void editorUndo() {
+	if (U.cur == 0) {
+		editorSetStatusMessage("Nothing to undo");
+		return;
+	}
+
+	U.applying = 1;
+	int group = undoAt(U.cur - 1)->group;
+	while (U.cur > 0 && undoAt(U.cur - 1)->group == group) {
+		editorUndoApply(undoAt(--U.cur), 1);
+	}
+	U.applying = 0;
+	U.can_merge = 0;
+
+	if (E.cursor_y > E.numrows) {
+		E.cursor_y = E.numrows;
+	}
+	erow* row = editorRowAt(E.cursor_y);
+	if (E.cursor_x > (row ? row->size : 0)) {
+		E.cursor_x = row ? row->size : 0;
+	}
+	editorSyntaxSettle(E.rowoffset + E.screenrows, HL_SYNC_BUDGET);
+}
+
+void editorRedo() {
+	if (U.cur == U.count) {
+		editorSetStatusMessage("Nothing to redo");
+		return;
+	}
+
+	U.applying = 1;
+	int group = undoAt(U.cur)->group;
+	while (U.cur < U.count && undoAt(U.cur)->group == group) {
+		editorUndoApply(undoAt(U.cur++), 0);
+	}
+	U.applying = 0;
+	U.can_merge = 0;
+
+	if (E.cursor_y > E.numrows) {
+		E.cursor_y = E.numrows;
+	}
+	erow* row = editorRowAt(E.cursor_y);
+	if (E.cursor_x > (row ? row->size : 0)) {
+		E.cursor_x = row ? row->size : 0;
+	}
+	editorSyntaxSettle(E.rowoffset + E.screenrows, HL_SYNC_BUDGET);
+}
+
+/* journal func realization */
+char* editorJournalPath(const char* filename) {
+	const char* slash = strrchr(filename, '/');
+	int dirlen = slash ? slash - filename + 1 : 0;
+	char* path = malloc(strlen(filename) + 32);
+	sprintf(path, "%.*s.%s.ctrlc-journal", dirlen, filename, filename + dirlen);
+
+	return path;
+}
+
+int journalPutVarint(unsigned char* p, size_t v) {
+	int n = 0;
+	while (v >= 0x80) {
+		p[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	p[n++] = v;
+
+	return n;
+}
+
+/* returns the bytes the varint at p took, 0 if it runs past end */
+int journalGetVarint(const unsigned char* p, const unsigned char* end, size_t* v) {
+	*v = 0;
+	for (int n = 0; p + n < end && n < 10; ++n) {
+		*v |= (size_t)(p[n] & 0x7f) << (7 * n);
+		if (!(p[n] & 0x80)) return n + 1;
+	}
+
+	return 0;
+}
+
+unsigned int journalHash(unsigned int h, const void* data, size_t len) {
+	const unsigned char* p = data;
+	for (size_t i = 0; i < len; ++i) {
+		h = (h ^ p[i]) * 16777619u;
+	}
+
+	return h;
+}
+
+/* appends one record, fields that the op does not have are left out */
+void editorJournalRecord(int op, int row, int col, int del, const char* text, int len) {
+	if (J.fd == -1 || J.replaying) return;
+
+	unsigned char head[48];
+	int n = 0;
+	head[n++] = op;
+	n += journalPutVarint(&head[n], row);
+	if (op == EDIT_SPLICE) {
+		n += journalPutVarint(&head[n], col);
+		n += journalPutVarint(&head[n], del);
+	}
+	if (op == EDIT_DELETE_ROW) {
+		len = 0;
+	}
+	else {
+		n += journalPutVarint(&head[n], len);
+	}
+
+	unsigned char size[10];
+	int size_len = journalPutVarint(size, n + len);
+	unsigned int hash = journalHash(journalHash(2166136261u, head, n), text, len);
+
+	size_t record = size_len + n + len + 4;
+	if (J.pending_len + record > J.pending_cap) {
+		J.pending_cap = J.pending_len + record > J.pending_cap * 2 ? J.pending_len + record : J.pending_cap * 2;
+		J.pending = realloc(J.pending, J.pending_cap);
+	}
+	char* p = &J.pending[J.pending_len];
+	memcpy(p, size, size_len);
+	memcpy(p + size_len, head, n);
+	if (len) memcpy(p + size_len + n, text, len);
+	memcpy(p + size_len + n + len, &hash, 4);
+	J.pending_len += record;
+	J.logged += record;
+
+	if (!J.unsynced) {
+		J.unsynced = 1;
+		clock_gettime(CLOCK_MONOTONIC, &J.oldest);
+	}
+	if (J.pending_len >= JOURNAL_BATCH) {
+		editorJournalFlush(0);
+	}
+}
+
+/* writes the pending records, and syncs them once the oldest has waited
+ * JOURNAL_SYNC_MS or when sync is set. A journal that cannot be written is
+ * given up on rather than left with holes */
+void editorJournalFlush(int sync) {
+	if (J.fd == -1) return;
+
+	if (J.pending_len) {
+		if (write(J.fd, J.pending, J.pending_len) != (ssize_t)J.pending_len) {
+			editorSetStatusMessage("Journal write failed, unsaved changes are not journaled: %s",
+					strerror(errno));
+			editorJournalClose();
+			return;
+		}
+		J.pending_len = 0;
+	}
+
+	if (!J.unsynced) return;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long ms = (now.tv_sec - J.oldest.tv_sec) * 1000 + (now.tv_nsec - J.oldest.tv_nsec) / 1000000;
+	if (sync || ms >= JOURNAL_SYNC_MS) {
+		fdatasync(J.fd);
+		J.unsynced = 0;
+	}
+}
+
+void editorJournalClose() {
+	if (J.fd != -1) {
+		close(J.fd);
+	}
+	J.fd = -1;
+	J.pending_len = 0;
+	J.logged = 0;
+	J.unsynced = 0;
+}
+
+/* makes a new journal holding the header of the file as it is on disk now
+ * and the records in tail, and puts it in place of the old one */
+void editorJournalStart(const char* tail, size_t len) {
+	editorJournalClose();
+
+	struct stat st;
+	if (E.filename == NULL || stat(E.filename, &st) == -1) return;
+
+	free(J.path);
+	J.path = editorJournalPath(E.filename);
+	char* tmp = malloc(strlen(J.path) + 8);
+	sprintf(tmp, "%s.new", J.path);
+
+	unsigned char header[JOURNAL_HEADER];
+	unsigned long long fields[3] = { st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec };
+	memcpy(header, JOURNAL_MAGIC, 8);
+	memcpy(&header[8], fields, sizeof(fields));
+
+	int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0600);
+	if (fd != -1) {
+		if (write(fd, header, JOURNAL_HEADER) == JOURNAL_HEADER &&
+				(len == 0 || write(fd, tail, len) == (ssize_t)len) &&
+				fdatasync(fd) == 0 && rename(tmp, J.path) == 0) {
+			J.fd = fd;
+			J.logged = len;
+		}
+		else {
+			close(fd);
+			unlink(tmp);
+		}
+	}
+	free(tmp);
+}
+
+/* applies records through the row operations and returns how many bytes of
+ * them were whole and made sense for the buffer */
+size_t editorJournalReplay(const unsigned char* data, size_t len) {
+	const unsigned char* p = data;
+	const unsigned char* end = data + len;
+
+	J.replaying = 1;
+	while (p < end) {
+		size_t size, op_row, col = 0, del = 0, text_len = 0;
+		int n = journalGetVarint(p, end, &size);
+		if (n == 0 || size == 0 || size > (size_t)(end - p - n) || end - p - n - size < 4) break;
+
+		const unsigned char* q = p + n;
+		const unsigned char* qend = q + size;
+		unsigned int hash;
+		memcpy(&hash, qend, 4);
+		if (hash != journalHash(2166136261u, q, size)) break;
+
+		int op = *q++;
+		int ok = (n = journalGetVarint(q, qend, &op_row)) != 0;
+		q += n;
+		if (ok && op == EDIT_SPLICE) {
+			ok = (n = journalGetVarint(q, qend, &col)) != 0;
+			q += n;
+			ok = ok && (n = journalGetVarint(q, qend, &del)) != 0;
+			q += n;
+		}
+		if (ok && op != EDIT_DELETE_ROW) {
+			ok = (n = journalGetVarint(q, qend, &text_len)) != 0 && text_len == (size_t)(qend - q - n);
+			q += n;
+		}
+		if (!ok) break;
+
+		if (op == EDIT_INSERT_ROW && op_row <= (size_t)E.numrows) {
+			editorInsertRow(op_row, (char*)q, text_len);
+		}
+		else if (op == EDIT_DELETE_ROW && op_row < (size_t)E.numrows) {
+			editorDelRow(op_row);
+		}
+		else if (op == EDIT_SPLICE && op_row < (size_t)E.numrows) {
+			erow* row = editorRowAt(op_row);
+			if (col + del > (size_t)row->size) break;
+			editorRowSplice(row, col, del, (const char*)q, text_len);
+		}
+		else {
+			break;
+		}
+		p = qend + 4;
+	}
+	J.replaying = 0;
+
+	return p - data;
+}
+
+/* looks for a journal left by an editor that did not get to quit, offers
+ * to replay it and then keeps journaling into it */
+void editorJournalOpen() {
+	J.fd = -1;
+	J.path = editorJournalPath(E.filename);
+
+	int fd = open(J.path, O_RDWR | O_APPEND);
+	if (fd == -1) {
+		editorJournalStart(NULL, 0);
+		return;
+	}
+
+	char* data = NULL;
+	size_t len = 0, cap = 0;
+	ssize_t n;
+	do {
+		if (len == cap) {
+			cap = cap ? cap * 2 : 1 << 16;
+			data = realloc(data, cap);
+		}
+		n = read(fd, &data[len], cap - len);
+		if (n > 0) len += n;
+	} while (n > 0 || (n == -1 && errno == EINTR));
+
+	/* records only apply to the very file they were made against */
+	struct stat st;
+	unsigned long long fields[3];
+	int match = len > JOURNAL_HEADER && memcmp(data, JOURNAL_MAGIC, 8) == 0 && stat(E.filename, &st) == 0;
+	if (match) {
+		memcpy(fields, &data[8], sizeof(fields));
+		match = fields[0] == (unsigned long long)st.st_size &&
+			fields[1] == (unsigned long long)st.st_mtim.tv_sec &&
+			fields[2] == (unsigned long long)st.st_mtim.tv_nsec;
+	}
+
+	int c = 'n';
+	while (match) {
+		editorSetStatusMessage("Recover unsaved changes to %s from its journal? (y/n)", E.filename);
+		editorRefreshScreen();
+		c = editorReadKey();
+		if (c == 'y' || c == 'n' || c == '\x1b') break;
+	}
+
+	if (c == 'y') {
+		editorLoadPoll(1); //the records may reach past the rows read so far
+		size_t valid = editorJournalReplay((unsigned char*)&data[JOURNAL_HEADER], len - JOURNAL_HEADER);
+		if (ftruncate(fd, JOURNAL_HEADER + valid) == 0) {
+			J.fd = fd;
+			J.logged = valid;
+		}
+		else {
+			close(fd);
+		}
+		editorSetStatusMessage("Recovered %d unsaved changes from the journal", E.dirty);
+	}
+	else {
+		close(fd);
+		if (len > JOURNAL_HEADER && !match) {
+			editorSetStatusMessage("Discarded a journal made against another version of the file");
+		}
+		editorJournalStart(NULL, 0);
+	}
+	free(data);
+}
+
+/* starts the journal over after a save: the file on disk now holds every
+ * edit logged before mark, those after it are carried over */
+void editorJournalRebase(size_t mark) {
+	if (E.filename == NULL) return;
+
+	/* edits made while no journal was kept cannot be carried over */
+	if (J.fd == -1 && E.dirty) return;
+
+	char* tail = NULL;
+	size_t len = 0;
+	if (J.fd != -1) {
+		editorJournalFlush(0);
+		len = J.logged - mark;
+		tail = malloc(len + 1);
+		if (J.fd == -1 || pread(J.fd, tail, len, JOURNAL_HEADER + mark) != (ssize_t)len) {
+			free(tail);
+			editorJournalClose();
+			return;
+		}
+	}
+
+	char* old = J.path ? strdup(J.path) : NULL;
+	editorJournalStart(tail, len);
+	if (old && J.path && strcmp(old, J.path) != 0) {
+		unlink(old);
+	}
+	free(old);
+	free(tail);
+}
+
+/* a clean quit leaves nothing to recover */
+void editorJournalRemove() {
+	editorJournalClose();
+	if (J.path) {
+		unlink(J.path);
+	}
+}
+
+/* search kernel func realization */
+int searchEqual(const char* a, const char* b, size_t len, int icase) {
+	if (!icase) return !memcmp(a, b, len);
+
+	for (size_t i = 0; i < len; ++i) {
+		if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i])) return 0;
+	}
+
+	return 1;
+}
+
+/* the kernels find needle in the len bytes at hay, which need not be NUL
+ * terminated. Candidates are filtered on the first and the last byte of the
+ * needle and confirmed with a full compare; ignoring case, both sides have
+ * bit 0x20 set before the filter, which keeps every letter match and lets
+ * searchEqual throw out the few false ones */
+const char* searchScalar(const char* hay, size_t len, const char* needle, size_t nlen, int icase) {
+	if (nlen == 0) return hay;
+	if (len < nlen) return NULL;
+
+	unsigned char fold = icase ? 0x20 : 0;
+	unsigned char first = needle[0] | fold;
+	unsigned char last = needle[nlen - 1] | fold;
+
+	for (size_t i = 0; i + nlen <= len; ++i) {
+		if (((unsigned char)hay[i] | fold) == first &&
+				((unsigned char)hay[i + nlen - 1] | fold) == last &&
+				searchEqual(&hay[i], needle, nlen, icase)) {
+			return &hay[i];
+		}
+	}
+
+	return NULL;
+}
+
+#ifdef CTRLC_SIMD_X86
+__attribute__((target("sse2")))
+const char* searchSSE2(const char* hay, size_t len, const char* needle, size_t nlen, int icase) {
+	if (nlen == 0) return hay;
+	if (len < nlen) return NULL;
+
+	char fold = icase ? 0x20 : 0;
+	__m128i vfold = _mm_set1_epi8(fold);
+	__m128i first = _mm_set1_epi8(needle[0] | fold);
+	__m128i last = _mm_set1_epi8(needle[nlen - 1] | fold);
+
+	size_t i = 0;
+	for (; i + nlen - 1 + 16 <= len; i += 16) {
+		__m128i a = _mm_or_si128(_mm_loadu_si128((const __m128i*)&hay[i]), vfold);
+		__m128i b = _mm_or_si128(_mm_loadu_si128((const __m128i*)&hay[i + nlen - 1]), vfold);
+		unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+
+		while (mask) {
+			size_t at = i + __builtin_ctz(mask);
+			if (searchEqual(&hay[at], needle, nlen, icase)) return &hay[at];
+			mask &= mask - 1;
+		}
+	}
+
+	return searchScalar(&hay[i], len - i, needle, nlen, icase);
+}
+
+__attribute__((target("avx2")))
+const char* searchAVX2(const char* hay, size_t len, const char* needle, size_t nlen, int icase) {
+	if (nlen == 0) return hay;
+	if (len < nlen) return NULL;
+
+	char fold = icase ? 0x20 : 0;
+	__m256i vfold = _mm256_set1_epi8(fold);
+	__m256i first = _mm256_set1_epi8(needle[0] | fold);
+	__m256i last = _mm256_set1_epi8(needle[nlen - 1] | fold);
+
+	size_t i = 0;
+	for (; i + nlen - 1 + 32 <= len; i += 32) {
+		__m256i a = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)&hay[i]), vfold);
+		__m256i b = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)&hay[i + nlen - 1]), vfold);
+		unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+
+		while (mask) {
+			size_t at = i + __builtin_ctz(mask);
+			if (searchEqual(&hay[at], needle, nlen, icase)) return &hay[at];
+			mask &= mask - 1;
+		}
+	}
+
+	return searchSSE2(&hay[i], len - i, needle, nlen, icase);
+}
+#endif
+
+/* picks the widest kernel the cpu runs, once */
+searchKernel editorSearchKernel() {
+	static searchKernel kernel = NULL;
+
+	if (kernel == NULL) {
+		kernel = searchScalar;
+#ifdef CTRLC_SIMD_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) {
+			kernel = searchAVX2;
+		}
+		else if (__builtin_cpu_supports("sse2")) {
+			kernel = searchSSE2;
+		}
+#endif
+	}
+
+	return kernel;
+}
+
+/* regex func realization */
+int regexAstNew(regexParser* ps, int op) {
+	if (ps->num_nodes == ps->cap) {
+		ps->cap = ps->cap ? ps->cap * 2 : 64;
+		ps->nodes = realloc(ps->nodes, sizeof(regexAst) * ps->cap);
+	}
+
+	regexAst* n = &ps->nodes[ps->num_nodes];
+	n->op = op;
+	n->ch = -1;
+	n->set = -1;
+	n->a = n->b = -1;
+	n->min = n->max = 0;
+
+	return ps->num_nodes++;
+}
+
+int regexSetNew(regexParser* ps) {
+	regexProg* prog = ps->prog;
+
+	if ((prog->num_sets & (prog->num_sets - 1)) == 0) {
+		prog->sets = realloc(prog->sets, 32 * (prog->num_sets ? prog->num_sets * 2 : 1));
+	}
+	memset(prog->sets[prog->num_sets], 0, 32);
+
+	return prog->num_sets++;
+}
+
+/* adds the other case of every letter in the set */
+void regexSetFold(unsigned char* set) {
+	for (int c = 'a'; c <= 'z'; ++c) {
+		int upper = toupper(c);
+		if ((set[c >> 3] >> (c & 7) & 1) || (set[upper >> 3] >> (upper & 7) & 1)) {
+			set[c >> 3] |= 1 << (c & 7);
+			set[upper >> 3] |= 1 << (upper & 7);
+		}
+	}
+}
+
+/* alt := cat ('|' cat)* */
+int regexParseAlt(regexParser* ps) {
+	int left = regexParseCat(ps);
+
+	while (left >= 0 && *ps->p == '|') {
+		++ps->p;
+		int right = regexParseCat(ps);
+		if (right < 0) return -1;
+
+		int n = regexAstNew(ps, RA_ALT);
+		ps->nodes[n].a = left;
+		ps->nodes[n].b = right;
+		left = n;
+	}
+
+	return left;
+}
+
+/* cat := repeat* */
+int regexParseCat(regexParser* ps) {
+	int left = regexAstNew(ps, RA_EMPTY);
+
+	while (*ps->p && *ps->p != '|' && *ps->p != ')') {
+		int right = regexParseRepeat(ps);
+		if (right < 0) return -1;
+
+		if (ps->nodes[left].op == RA_EMPTY) {
+			left = right;
+		}
+		else {
+			int n = regexAstNew(ps, RA_CAT);
+			ps->nodes[n].a = left;
+			ps->nodes[n].b = right;
+			left = n;
+		}
+	}
+
+	return left;
+}
+
+/* repeat := atom ('*' | '+' | '?' | '{m}' | '{m,}' | '{m,n}')* */
+int regexParseRepeat(regexParser* ps) {
+	int atom = regexParseAtom(ps);
+
+	while (atom >= 0) {
+		int min, max;
+		if (*ps->p == '*' || *ps->p == '+' || *ps->p == '?') {
+			min = *ps->p == '+' ? 1 : 0;
+			max = *ps->p == '?' ? 1 : -1;
+			++ps->p;
+		}
+		else if (*ps->p != '{' || !regexParseCount(ps, &min, &max)) {
+			break;
+		}
+		if (ps->error) return -1;
+
+		int op = ps->nodes[atom].op;
+		if (op == RA_EMPTY || op == RA_BOL || op == RA_EOL) {
+			ps->error = "nothing to repeat";
+			return -1;
+		}
+
+		int n = regexAstNew(ps, RA_REPEAT);
+		ps->nodes[n].a = atom;
+		ps->nodes[n].min = min;
+		ps->nodes[n].max = max;
+		atom = n;
+	}
+
+	return atom;
+}
+
+/* reads {m}, {m,} or {m,n} at ps->p; anything else is left alone for the
+ * '{' to be taken as a plain byte, and 0 is returned */
+int regexParseCount(regexParser* ps, int* min, int* max) {
+	const char* p = ps->p + 1;
+
+	if (!isdigit((unsigned char)*p)) return 0;
+	*min = 0;
+	while (isdigit((unsigned char)*p)) {
+		*min = *min > REGEX_MAX_REPEAT ? *min : *min * 10 + (*p - '0');
+		++p;
+	}
+	*max = *min;
+
+	if (*p == ',') {
+		++p;
+		*max = -1;
+		if (isdigit((unsigned char)*p)) {
+			*max = 0;
+			while (isdigit((unsigned char)*p)) {
+				*max = *max > REGEX_MAX_REPEAT ? *max : *max * 10 + (*p - '0');
+				++p;
+			}
+		}
+	}
+	if (*p != '}') return 0;
+	ps->p = p + 1;
+
+	if (*min > REGEX_MAX_REPEAT || *max > REGEX_MAX_REPEAT) {
+		ps->error = "count too large";
+	}
+	else if (*max >= 0 && *max < *min) {
+		ps->error = "bad count";
+	}
+
+	return 1;
+}
+
+int regexParseAtom(regexParser* ps) {
+	unsigned char c = *ps->p;
+	int n;
+
+	switch (c) {
+		case '(':
+			++ps->p;
+			if (ps->p[0] == '?' && ps->p[1] == ':') {
+				ps->p += 2;
+			}
+			n = regexParseAlt(ps);
+			if (n < 0) return -1;
+			if (*ps->p != ')') {
+				ps->error = "missing )";
+				return -1;
+			}
+			++ps->p;
+			return n;
+		case '[':
+			return regexParseClass(ps);
+		case '^':
+			++ps->p;
+			return regexAstNew(ps, RA_BOL);
+		case '$':
+			++ps->p;
+			return regexAstNew(ps, RA_EOL);
+		case '*':
+		case '+':
+		case '?':
+			ps->error = "nothing to repeat";
+			return -1;
+	}
+
+	n = regexAstNew(ps, RA_CHAR);
+	int set = regexSetNew(ps);
+	ps->nodes[n].set = set;
+	unsigned char* bits = ps->prog->sets[set];
+
+	if (c == '.') {
+		memset(bits, 0xff, 32);
+		bits['\n' >> 3] &= ~(1 << ('\n' & 7));
+		++ps->p;
+	}
+	else if (c == '\\') {
+		++ps->p;
+		ps->nodes[n].ch = regexParseEscape(ps, bits);
+		if (ps->error) return -1;
+	}
+	else {
+		bits[c >> 3] |= 1 << (c & 7);
+		ps->nodes[n].ch = c;
+		++ps->p;
+	}
+	if (ps->icase) {
+		regexSetFold(bits);
+	}
+
+	return n;
+}
+
+/* adds what the escape after a backslash stands for to set and returns
+ * the byte for a single byte escape, -1 for a class */
+int regexParseEscape(regexParser* ps, unsigned char* set) {
+	unsigned char c = *ps->p;
+	int negate = isupper(c) != 0;
+	int ch = -1;
+
+	switch (tolower(c)) {
+		case 'd':
+		case 'w':
+		case 's':
+			for (int b = 0; b < 256; ++b) {
+				int in = b < 128 && (tolower(c) == 'd' ? isdigit(b) :
+					tolower(c) == 'w' ? isalnum(b) || b == '_' : isspace(b));
+				if (in != negate) {
+					set[b >> 3] |= 1 << (b & 7);
+				}
+			}
+			++ps->p;
+			return -1;
+	}
+
+	if (c == '\0') {
+		ps->error = "trailing \\";
+		return -1;
+	}
+	else if (c == 't') {
+		ch = '\t';
+	}
+	else if (c == 'x' && isxdigit((unsigned char)ps->p[1]) && isxdigit((unsigned char)ps->p[2])) {
+		char hex[3] = { ps->p[1], ps->p[2], '\0' };
+		ch = strtol(hex, NULL, 16);
+		ps->p += 2;
+	}
+	else if (isalnum(c)) {
+		ps->error = "unknown escape";
+		return -1;
+	}
+	else {
+		ch = c;
+	}
+	++ps->p;
+	set[ch >> 3] |= 1 << (ch & 7);
+
+	return ch;
+}
+
+/* class := '[' '^'? (byte | byte '-' byte | escape)+ ']', a ']' right
+ * after the opening is taken as a plain byte */
+int regexParseClass(regexParser* ps) {
+	int n = regexAstNew(ps, RA_CHAR);
+	int set = regexSetNew(ps);
+	ps->nodes[n].set = set;
+	unsigned char* bits = ps->prog->sets[set];
+
+	++ps->p;
+	int negate = *ps->p == '^';
+	if (negate) ++ps->p;
+
+	const char* first = ps->p;
+	while (*ps->p != ']' || ps->p == first) {
+		if (*ps->p == '\0') {
+			ps->error = "missing ]";
+			return -1;
+		}
+
+		int lo;
+		if (*ps->p == '\\') {
+			++ps->p;
+			lo = regexParseEscape(ps, bits);
+			if (ps->error) return -1;
+			if (lo < 0) continue;
+		}
+		else {
+			lo = (unsigned char)*ps->p++;
+		}
+
+		int hi = lo;
+		if (ps->p[0] == '-' && ps->p[1] != ']' && ps->p[1] != '\0') {
+			++ps->p;
+			unsigned char scratch[32];
+			if (*ps->p == '\\') {
+				++ps->p;
+				hi = regexParseEscape(ps, scratch);
+				if (ps->error) return -1;
+			}
+			else {
+				hi = (unsigned char)*ps->p++;
+			}
+			if (hi < lo) {
+				ps->error = "bad range";
+				return -1;
+			}
+		}
+		for (int b = lo; b <= hi; ++b) {
+			bits[b >> 3] |= 1 << (b & 7);
+		}
+	}
+	++ps->p;
+
+	if (ps->icase) {
+		regexSetFold(bits);
+	}
+	if (negate) {
+		for (int i = 0; i < 32; ++i) {
+			bits[i] = ~bits[i];
+		}
+		bits['\n' >> 3] &= ~(1 << ('\n' & 7));
+	}
+
+	return n;
+}
+
+/* NFA nodes the subtree at n compiles to, saturating past the limit */
+long regexAstSize(regexAst* ast, int n) {
+	regexAst* a = &ast[n];
+	long size = 0;
+
+	switch (a->op) {
+		case RA_CHAR:
+		case RA_BOL:
+		case RA_EOL:
+			size = 1;
+			break;
+		case RA_CAT:
+			size = regexAstSize(ast, a->a) + regexAstSize(ast, a->b);
+			break;
+		case RA_ALT:
+			size = regexAstSize(ast, a->a) + regexAstSize(ast, a->b) + 1;
+			break;
+		case RA_REPEAT:
+			size = regexAstSize(ast, a->a);
+			size = a->max < 0 ? (a->min + 1) * size + 1 : a->min * size + (a->max - a->min) * (size + 1);
+			break;
+	}
+
+	return size > REGEX_MAX_NODES ? REGEX_MAX_NODES + 1 : size;
+}
+
+int regexNodeNew(regexNFA* nfa, int op, int set, int out, int out1) {
+	if (nfa->num_nodes == nfa->cap) {
+		nfa->cap = nfa->cap ? nfa->cap * 2 : 64;
+		nfa->nodes = realloc(nfa->nodes, sizeof(regexNode) * nfa->cap);
+	}
+
+	regexNode* node = &nfa->nodes[nfa->num_nodes];
+	node->op = op;
+	node->set = set;
+	node->out = out;
+	node->out1 = out1;
+
+	return nfa->num_nodes++;
+}
+
+/* compiles the subtree at n so that it goes on to next and returns its
+ * entry; reverse builds the NFA of the pattern read backwards, which swaps
+ * the order of concatenations and the row start and end */
+int regexEmit(regexNFA* nfa, regexAst* ast, int n, int next, int reverse) {
+	regexAst* a = &ast[n];
+	int x, y;
+
+	switch (a->op) {
+		case RA_CHAR:
+			return regexNodeNew(nfa, RE_CHAR, a->set, next, -1);
+		case RA_BOL:
+			return regexNodeNew(nfa, reverse ? RE_EOL : RE_BOL, -1, next, -1);
+		case RA_EOL:
+			return regexNodeNew(nfa, reverse ? RE_BOL : RE_EOL, -1, next, -1);
+		case RA_CAT:
+			x = regexEmit(nfa, ast, reverse ? a->a : a->b, next, reverse);
+			return regexEmit(nfa, ast, reverse ? a->b : a->a, x, reverse);
+		case RA_ALT:
+			x = regexEmit(nfa, ast, a->a, next, reverse);
+			y = regexEmit(nfa, ast, a->b, next, reverse);
+			return regexNodeNew(nfa, RE_SPLIT, -1, x, y);
+		case RA_REPEAT:
+			/* the optional copies first, each may leave for next, then the
+			 * required ones in front of them */
+			x = next;
+			if (a->max < 0) {
+				x = regexNodeNew(nfa, RE_SPLIT, -1, -1, next);
+				y = regexEmit(nfa, ast, a->a, x, reverse);
+				nfa->nodes[x].out = y;
+			}
+			for (int k = 0; k < a->max - a->min; ++k) {
+				y = regexEmit(nfa, ast, a->a, x, reverse);
+				x = regexNodeNew(nfa, RE_SPLIT, -1, y, next);
+			}
+			for (int k = 0; k < a->min; ++k) {
+				x = regexEmit(nfa, ast, a->a, x, reverse);
+			}
+			return x;
+	}
+
+	return next;
+}
+
+void regexBuildNFA(regexNFA* nfa, regexAst* ast, int root, int any, int reverse) {
+	int match = regexNodeNew(nfa, RE_MATCH, -1, -1, -1);
+	nfa->start = regexEmit(nfa, ast, root, match, reverse);
+
+	int skip = regexNodeNew(nfa, RE_CHAR, any, -1, -1);
+	nfa->loop = regexNodeNew(nfa, RE_SPLIT, -1, nfa->start, skip);
+	nfa->nodes[skip].out = nfa->loop;
+}
+
+/* finds the longest run of plain bytes in the top level concatenation,
+ * every match has to hold it. Line breaks end a run: no row holds one, but
+ * the map chunks the kernel reads do, so a literal with one would be found
+ * across row ends */
+void regexFindLiteral(regexProg* prog, regexAst* ast, int root) {
+	int stack[REGEX_LITERAL_MAX * 4];
+	int top = 0;
+	char run[REGEX_LITERAL_MAX];
+	int run_len = 0;
+
+	prog->literal_len = 0;
+	prog->literal_only = 1;
+	stack[top++] = root;
+	while (top) {
+		regexAst* a = &ast[stack[--top]];
+		if (a->op == RA_CAT && top + 2 <= (int)(sizeof(stack) / sizeof(stack[0]))) {
+			stack[top++] = a->b;
+			stack[top++] = a->a;
+			continue;
+		}
+
+		int plain = a->op == RA_CHAR && a->ch >= 0 && a->ch != '\n' && a->ch != '\r';
+		if (!plain || run_len == REGEX_LITERAL_MAX) {
+			prog->literal_only = 0;
+		}
+		if (plain && run_len < REGEX_LITERAL_MAX) {
+			run[run_len++] = a->ch;
+			if (run_len > prog->literal_len) {
+				memcpy(prog->literal, run, run_len);
+				prog->literal_len = run_len;
+			}
+		}
+		else if (a->op != RA_EMPTY) {
+			run_len = 0;
+		}
+	}
+}
+
+/* compiles pattern, or returns NULL and points error at the reason */
+regexProg* regexCompile(const char* pattern, int icase, const char** error) {
+	regexProg* prog = calloc(1, sizeof(regexProg));
+	regexParser ps = { pattern, icase, NULL, 0, 0, prog, NULL };
+
+	int root = regexParseAlt(&ps);
+	if (root >= 0 && *ps.p == ')') {
+		ps.error = "unmatched )";
+	}
+	if (!ps.error && regexAstSize(ps.nodes, root) + 3 > REGEX_MAX_NODES) {
+		ps.error = "pattern too large";
+	}
+	if (ps.error) {
+		*error = ps.error;
+		free(ps.nodes);
+		regexFree(prog);
+		return NULL;
+	}
+
+	int any = regexSetNew(&ps);
+	memset(prog->sets[any], 0xff, 32);
+	regexBuildNFA(&prog->fwd, ps.nodes, root, any, 0);
+	regexBuildNFA(&prog->rev, ps.nodes, root, any, 1);
+	regexFindLiteral(prog, ps.nodes, root);
+	free(ps.nodes);
+
+	/* splits the bytes into classes, refining them with one set at a time */
+	memset(prog->bclass, 0, sizeof(prog->bclass));
+	prog->num_classes = 1;
+	for (int i = 0; i < prog->num_sets; ++i) {
+		int renumber[2][256];
+		int num = 0;
+		memset(renumber, -1, sizeof(renumber));
+		for (int b = 0; b < 256; ++b) {
+			int in = prog->sets[i][b >> 3] >> (b & 7) & 1;
+			if (renumber[in][prog->bclass[b]] < 0) {
+				renumber[in][prog->bclass[b]] = num++;
+			}
+			prog->bclass[b] = renumber[in][prog->bclass[b]];
+		}
+		prog->num_classes = num;
+	}
+	for (int b = 255; b >= 0; --b) {
+		prog->class_byte[prog->bclass[b]] = b;
+	}
+
+	return prog;
+}
+
+void regexFree(regexProg* prog) {
+	if (prog == NULL) return;
+
+	free(prog->fwd.nodes);
+	free(prog->rev.nodes);
+	free(prog->sets);
+	free(prog);
+}
+
+void regexDFAInit(regexDFA* d, regexProg* prog, regexNFA* nfa, int anchored) {
+	memset(d, 0, sizeof(regexDFA));
+	d->prog = prog;
+	d->nfa = nfa;
+	d->anchored = anchored;
+	d->start[0] = d->start[1] = -1;
+	d->accel = -2;
+	d->table = malloc(sizeof(int) * 2 * REGEX_DFA_STATES);
+	memset(d->table, -1, sizeof(int) * 2 * REGEX_DFA_STATES);
+	d->mark = calloc(nfa->num_nodes, sizeof(unsigned int));
+	d->stack = malloc(sizeof(int) * (3 * nfa->num_nodes + 1));
+	d->list = malloc(sizeof(int) * nfa->num_nodes);
+}
+
+void regexDFAFree(regexDFA* d) {
+	free(d->trans);
+	free(d->flags);
+	free(d->bol);
+	free(d->set_at);
+	free(d->set_len);
+	free(d->pool);
+	free(d->table);
+	free(d->mark);
+	free(d->stack);
+	free(d->list);
+	memset(d, 0, sizeof(regexDFA));
+}
+
+void regexNewMark(regexDFA* d) {
+	if (++d->mark_gen == 0) {
+		memset(d->mark, 0, sizeof(unsigned int) * d->nfa->num_nodes);
+		d->mark_gen = 1;
+	}
+}
+
+/* adds node and what it reaches without consuming a byte to d->list, nodes
+ * already marked in this round are skipped. Only bytes, row ends and the
+ * match are kept, row starts are passed only when bol is set */
+void regexClosure(regexDFA* d, int node, int bol, int* len) {
+	regexNode* nodes = d->nfa->nodes;
+	int top = 0;
+
+	d->stack[top++] = node;
+	while (top) {
+		int n = d->stack[--top];
+		if (d->mark[n] == d->mark_gen) continue;
+		d->mark[n] = d->mark_gen;
+
+		if (nodes[n].op == RE_SPLIT) {
+			d->stack[top++] = nodes[n].out1;
+			d->stack[top++] = nodes[n].out;
+		}
+		else if (nodes[n].op == RE_BOL) {
+			if (bol) d->stack[top++] = nodes[n].out;
+		}
+		else {
+			d->list[(*len)++] = n;
+		}
+	}
+}
+
+/* whether the nodes reach the match once the row end is passed */
+int regexEndMatch(regexDFA* d, int* list, int len, int bol) {
+	regexNode* nodes = d->nfa->nodes;
+	int top = 0;
+
+	regexNewMark(d);
+	for (int i = 0; i < len; ++i) {
+		if (nodes[list[i]].op == RE_MATCH) return 1;
+		if (nodes[list[i]].op == RE_EOL) d->stack[top++] = nodes[list[i]].out;
+	}
+	while (top) {
+		int n = d->stack[--top];
+		if (d->mark[n] == d->mark_gen) continue;
+		d->mark[n] = d->mark_gen;
+
+		switch (nodes[n].op) {
+			case RE_MATCH:
+				return 1;
+			case RE_SPLIT:
+				d->stack[top++] = nodes[n].out1;
+				d->stack[top++] = nodes[n].out;
+				break;
+			case RE_EOL:
+				d->stack[top++] = nodes[n].out;
+				break;
+			case RE_BOL:
+				if (bol) d->stack[top++] = nodes[n].out;
+				break;
+		}
+	}
+
+	return 0;
+}
+
+int regexCompareInt(const void* a, const void* b) {
+	return *(const int*)a - *(const int*)b;
+}
+
+/* the state holding the sorted node list, made if it is new */
+int regexState(regexDFA* d, int* list, int len, int bol) {
+	unsigned int hash = 2166136261u ^ bol;
+	for (int i = 0; i < len; ++i) {
+		hash = (hash ^ list[i]) * 16777619u;
+	}
+
+	unsigned int mask = 2 * REGEX_DFA_STATES - 1;
+	unsigned int h = hash & mask;
+	for (; d->table[h] >= 0; h = (h + 1) & mask) {
+		int s = d->table[h];
+		if (d->set_len[s] == len && d->bol[s] == bol &&
+				!memcmp(&d->pool[d->set_at[s]], list, sizeof(int) * len)) {
+			return s;
+		}
+	}
+
+	if (d->num_states == REGEX_DFA_STATES) {
+		d->num_states = 0;
+		d->pool_len = 0;
+		d->start[0] = d->start[1] = -1;
+		d->accel = -2;
+		memset(d->table, -1, sizeof(int) * 2 * REGEX_DFA_STATES);
+		h = hash & mask;
+	}
+
+	if (d->num_states == d->cap) {
+		d->cap = d->cap ? d->cap * 2 : 16;
+		d->trans = realloc(d->trans, sizeof(int) * d->cap * d->prog->num_classes);
+		d->flags = realloc(d->flags, d->cap * d->prog->num_classes);
+		d->bol = realloc(d->bol, d->cap);
+		d->set_at = realloc(d->set_at, sizeof(int) * d->cap);
+		d->set_len = realloc(d->set_len, sizeof(int) * d->cap);
+	}
+	if (d->pool_len + len > d->pool_cap) {
+		d->pool_cap = (d->pool_len + len) * 2;
+		d->pool = realloc(d->pool, sizeof(int) * d->pool_cap);
+	}
+
+	int s = d->num_states++;
+	memset(&d->trans[s * d->prog->num_classes], -1, sizeof(int) * d->prog->num_classes);
+	d->set_at[s] = d->pool_len;
+	d->set_len[s] = len;
+	d->bol[s] = bol;
+	memcpy(&d->pool[d->pool_len], list, sizeof(int) * len);
+	d->pool_len += len;
+	d->table[h] = s;
+
+	unsigned char* flags = &d->flags[s * d->prog->num_classes];
+	*flags = len == 0 ? RE_STATE_DEAD : 0;
+	for (int i = 0; i < len; ++i) {
+		if (d->nfa->nodes[list[i]].op == RE_MATCH) *flags |= RE_STATE_MATCH;
+	}
+	if (regexEndMatch(d, list, len, bol)) {
+		*flags |= RE_STATE_EOL_MATCH;
+	}
+
+	return s;
+}
+
+int regexStart(regexDFA* d, int bol) {
+	if (d->start[bol] < 0) {
+		int len = 0;
+		regexNewMark(d);
+		regexClosure(d, d->anchored ? d->nfa->start : d->nfa->loop, bol, &len);
+		qsort(d->list, len, sizeof(int), regexCompareInt);
+		int s = regexState(d, d->list, len, bol);
+		d->start[bol] = s * d->prog->num_classes;
+	}
+
+	return d->start[bol];
+}
+
+/* follows the state at offset from on byte class c for the first time */
+int regexStep(regexDFA* d, int from, int c) {
+	regexNode* nodes = d->nfa->nodes;
+	int byte = d->prog->class_byte[c];
+	int s = from / d->prog->num_classes;
+	int len = 0;
+
+	regexNewMark(d);
+	for (int i = 0; i < d->set_len[s]; ++i) {
+		regexNode* node = &nodes[d->pool[d->set_at[s] + i]];
+		if (node->op == RE_CHAR && (d->prog->sets[node->set][byte >> 3] >> (byte & 7) & 1)) {
+			regexClosure(d, node->out, 0, &len);
+		}
+	}
+	qsort(d->list, len, sizeof(int), regexCompareInt);
+
+	/* s is gone if making the state dropped the cache */
+	int states = d->num_states;
+	int next = regexState(d, d->list, len, 0) * d->prog->num_classes;
+	if (d->num_states >= states) {
+		d->trans[from + c] = next;
+	}
+
+	return next;
+}
+
+/* unanchored scans spend most bytes in the start state, going round the
+ * skip loop; when it is not a match state its stay bytes are skipped in a
+ * tight loop that does not chase transitions */
+void regexAccel(regexDFA* d) {
+	int s = regexStart(d, 0);
+	unsigned char stay[256];
+
+	d->accel = -1;
+	if (d->anchored || d->flags[s]) return;
+
+	for (int c = 0; c < d->prog->num_classes; ++c) {
+		int next = d->trans[s + c] >= 0 ? d->trans[s + c] : regexStep(d, s, c);
+		if (d->accel == -2) return; //the cache was dropped, try again next scan
+		stay[c] = next == s;
+	}
+	for (int b = 0; b < 256; ++b) {
+		d->stay[b] = stay[d->prog->bclass[b]];
+	}
+	d->accel = s;
+}
+
+/* runs the reversed pattern from the row end back to its start, marks
+ * every position a match begins at and returns whether there was one */
+int regexMarkStarts(regexDFA* d, const char* text, int len, unsigned char* starts) {
+	const unsigned char* bclass = d->prog->bclass;
+	if (d->accel == -2) regexAccel(d);
+	int s = regexStart(d, 1);
+	int found = 0;
+
+	for (int i = len - 1; i >= 0; --i) {
+		if (s == d->accel) {
+			while (i >= 0 && d->stay[(unsigned char)text[i]]) starts[i--] = 0;
+			if (i < 0) break;
+		}
+		int c = bclass[(unsigned char)text[i]];
+		int next = d->trans[s + c];
+		s = next >= 0 ? next : regexStep(d, s, c);
+		starts[i] = (d->flags[s] & (i ? RE_STATE_MATCH : RE_STATE_EOL_MATCH)) != 0;
+		found |= starts[i];
+	}
+
+	return found;
+}
+
+/* end of the longest match beginning at from, -1 if there is none. The
+ * bytes read to find it are added to scanned */
+int regexLongestEnd(regexDFA* d, const char* text, int len, int from, int* scanned) {
+	const unsigned char* bclass = d->prog->bclass;
+	int s = regexStart(d, from == 0);
+	int end = d->flags[s] & (from == len ? RE_STATE_EOL_MATCH : RE_STATE_MATCH) ? from : -1;
+	int i;
+
+	for (i = from; i < len; ++i) {
+		int c = bclass[(unsigned char)text[i]];
+		int next = d->trans[s + c];
+		s = next >= 0 ? next : regexStep(d, s, c);
+		if (d->flags[s] & RE_STATE_DEAD) break;
+		if (d->flags[s] & (i + 1 == len ? RE_STATE_EOL_MATCH : RE_STATE_MATCH)) end = i + 1;
+	}
+	*scanned += i - from;
+
+	return end;
+}
+
+/* adds a thread for the match begun at tag at node, and at what it reaches
+ * at row position i without consuming a byte, to list. Nodes a thread from
+ * an earlier start took this step are skipped: their futures are the same
+ * and the earlier start wins. A match reached ends tag's match at i */
+void regexAddThread(regexCache* re, regexThreads* list, int node, int tag, int i, int len) {
+	regexNode* nodes = re->longest.nfa->nodes;
+	int top = 0;
+
+	re->stack[top++] = node;
+	while (top) {
+		int n = re->stack[--top];
+		if (re->mark[n] == re->mark_gen) continue;
+		re->mark[n] = re->mark_gen;
+
+		switch (nodes[n].op) {
+			case RE_CHAR:
+				list->node[list->len] = n;
+				list->tag[list->len++] = tag;
+				break;
+			case RE_SPLIT:
+				re->stack[top++] = nodes[n].out1;
+				re->stack[top++] = nodes[n].out;
+				break;
+			case RE_BOL:
+				if (i == 0) re->stack[top++] = nodes[n].out;
+				break;
+			case RE_EOL:
+				if (i == len) re->stack[top++] = nodes[n].out;
+				break;
+			case RE_MATCH:
+				re->ends[tag] = i;
+				break;
+		}
+	}
+}
+
+/* collects the leftmost longest matches of the row from from on in a single
+ * forward pass, for rows where the anchored pass would read the same bytes
+ * again for every start. A thread is started at each position the reversed
+ * pattern marked, tagged with it. A match reached covers every later start
+ * still running, they all began before it ends, so their threads are
+ * dropped. q is the leftmost start not settled yet; once no thread of it is
+ * left its match is taken and the starts it covers are skipped */
+void regexLongestPass(regexCache* re, const char* text, int len, int from, int at, searchRange* out) {
+	regexNFA* nfa = re->longest.nfa;
+	unsigned char (*sets)[32] = re->longest.prog->sets;
+	regexThreads* cur = &re->threads[0];
+	regexThreads* next = &re->threads[1];
+	int q = from;
+
+	if (re->ends_cap < len + 1) {
+		re->ends_cap = (len + 1) * 2;
+		free(re->ends);
+		re->ends = malloc(sizeof(int) * re->ends_cap);
+	}
+
+	cur->len = 0;
+	if (++re->mark_gen == 0) {
+		memset(re->mark, 0, sizeof(unsigned int) * nfa->num_nodes);
+		re->mark_gen = 1;
+	}
+	for (int i = from; ; ++i) {
+		re->ends[i] = i;
+		if (i < len && re->starts[i]) {
+			regexAddThread(re, cur, nfa->start, i, i, len);
+		}
+
+		/* threads are in order of their starts, starts before the first
+		 * one left are settled */
+		int live = i < len && cur->len ? cur->tag[0] : len + 1;
+		while (q < live && q <= i) {
+			if (re->ends[q] > q) {
+				editorSearchAdd(out, at, q, re->ends[q] - q);
+				q = re->ends[q];
+			}
+			else {
+				++q; //empty matches are not shown
+			}
+		}
+		if (i == len) break;
+
+		unsigned char b = text[i];
+		next->len = 0;
+		if (++re->mark_gen == 0) {
+			memset(re->mark, 0, sizeof(unsigned int) * nfa->num_nodes);
+			re->mark_gen = 1;
+		}
+		int cover = len + 1;
+		for (int k = 0; k < cur->len && cur->tag[k] <= cover; ++k) {
+			int tag = cur->tag[k];
+			regexNode* node = &nfa->nodes[cur->node[k]];
+			if (sets[node->set][b >> 3] >> (b & 7) & 1) {
+				regexAddThread(re, next, node->out, tag, i + 1, len);
+				if (re->ends[tag] == i + 1 && cover > len) cover = tag;
+			}
+		}
+
+		regexThreads* swap = cur;
+		cur = next;
+		next = swap;
+	}
+}
+
+/* sets the passes up for prog, dropping what was cached for an older query */
+void regexCacheReset(regexCache* cache, regexProg* prog, unsigned int generation) {
+	regexDFAFree(&cache->rev);
+	regexDFAFree(&cache->longest);
+
+	cache->generation = generation;
+	regexDFAInit(&cache->rev, prog, &prog->rev, 0);
+	regexDFAInit(&cache->longest, prog, &prog->fwd, 1);
+
+	int n = prog->fwd.num_nodes;
+	for (int k = 0; k < 2; ++k) {
+		free(cache->threads[k].node);
+		free(cache->threads[k].tag);
+		cache->threads[k].node = malloc(sizeof(int) * n);
+		cache->threads[k].tag = malloc(sizeof(int) * n);
+	}
+	free(cache->mark);
+	free(cache->stack);
+	cache->mark = calloc(n, sizeof(unsigned int));
+	cache->mark_gen = 0;
+	cache->stack = malloc(sizeof(int) * (2 * n + 1));
+}
+
+void regexCacheFree(regexCache* cache) {
+	regexDFAFree(&cache->rev);
+	regexDFAFree(&cache->longest);
+	free(cache->starts);
+	cache->starts = NULL;
+	cache->starts_cap = 0;
+	for (int k = 0; k < 2; ++k) {
+		free(cache->threads[k].node);
+		free(cache->threads[k].tag);
+		cache->threads[k].node = cache->threads[k].tag = NULL;
+	}
+	free(cache->mark);
+	free(cache->stack);
+	free(cache->ends);
+	cache->mark = NULL;
+	cache->stack = cache->ends = NULL;
+	cache->ends_cap = 0;
+}
+
+/* search engine func realization */
+void editorSearchAdd(searchRange* out, int row, int cx, int len) {
+	if (out->count == out->cap) {
+		out->cap = out->cap ? out->cap * 2 : 64;
+		out->matches = realloc(out->matches, sizeof(searchMatch) * out->cap);
+	}
+
+	out->matches[out->count].row = row;
+	out->matches[out->count].cx = cx;
+	out->matches[out->count].len = len;
+	++out->count;
+}
+
+/* collects the leftmost longest matches of a row, reading its text in
+ * place. The reversed pattern marks where matches start in one pass over
+ * the row, then from each start not covered by the match before it the
+ * anchored pass finds the longest end. Those passes can read far past the
+ * end they find and do so again from the next start, so once they have
+ * read twice the row the rest is left to the tagged pass, keeping the row
+ * linear */
+void editorSearchRegexRow(regexCache* re, const char* text, int len, int at, searchRange* out) {
+	if (re->starts_cap < len) {
+		re->starts_cap = len * 2;
+		free(re->starts);
+		re->starts = malloc(re->starts_cap);
+	}
+	if (!regexMarkStarts(&re->rev, text, len, re->starts)) return;
+
+	int p = 0;
+	int scanned = 0;
+	while (p < len) {
+		unsigned char* start = memchr(&re->starts[p], 1, len - p);
+		if (start == NULL) break;
+		p = start - re->starts;
+
+		if (scanned > 2 * len) {
+			regexLongestPass(re, text, len, p, at, out);
+			break;
+		}
+		int end = regexLongestEnd(&re->longest, text, len, p, &scanned);
+		if (end > p) {
+			editorSearchAdd(out, at, p, end - p);
+			p = end;
+		}
+		else {
+			++p; //empty matches are not shown
+		}
+	}
+}
+
+/* collects every match of query in rows [from, to) into out. Rows that sit
+ * back to back in the map are scanned as one chunk; the query never holds a
+ * line break, so a hit always falls within a single row of the chunk.
+ * With re set the rows are matched against its regex and query is the
+ * literal every match holds, only rows where the kernel finds it are run
+ * through the DFA, or all of them when there is no such literal.
+ * Returns 0 if the scan was given up because a newer query started */
+int editorSearchRows(int from, int to, const char* query, int qlen, int icase, regexCache* re,
+		unsigned int generation, searchRange* out) {
+	searchKernel kernel = editorSearchKernel();
+	erow* row = editorRowAt(from);
+	int at = from;
+
+	while (row && at < to) {
+		if (__atomic_load_n(&SE.generation, __ATOMIC_RELAXED) != generation) return 0;
+
+		if (re && qlen == 0) {
+			editorSearchRegexRow(re, editorRowText(row), row->size, at, out);
+			row = editorRowNext(row);
+			++at;
+			continue;
+		}
+
+		erow* first = row;
+		int first_at = at;
+		const char* text = editorRowText(row);
+		size_t start = row->data.src;
+		size_t end = row->data.src + row->size;
+
+		row = editorRowNext(row);
+		++at;
+		if (first->chars == NULL) {
+			while (row && at < to && row->chars == NULL && end - start < SEARCH_CHUNK &&
+					(row->data.src == end + 1 || (row->data.src == end + 2 && E.map[end] == '\r'))) {
+				end = row->data.src + row->size;
+				row = editorRowNext(row);
+				++at;
+			}
+		}
+
+		/* hits come in order, so the row holding one is found by walking on
+		 * from the row that held the one before */
+		erow* hit_row = first;
+		int hit_at = first_at;
+		size_t len = end - start;
+		const char* p = text;
+		const char* hit;
+		while ((hit = kernel(p, len - (p - text), query, qlen, icase)) != NULL) {
+			size_t pos = start + (hit - text);
+			while (pos + qlen > hit_row->data.src + hit_row->size && hit_row->chars == NULL) {
+				hit_row = editorRowNext(hit_row);
+				++hit_at;
+			}
+
+			if (re) {
+				size_t row_start = hit_row->chars ? 0 : hit_row->data.src - start;
+				editorSearchRegexRow(re, text + row_start, hit_row->size, hit_at, out);
+				p = text + row_start + hit_row->size; //the rest of the row is done
+				continue;
+			}
+
+			editorSearchAdd(out, hit_at, hit_row->chars ? hit - text : (int)(pos - hit_row->data.src), qlen);
+			p = hit + qlen;
+		}
+	}
+
+	return 1;
+}
+
+void* editorSearchWorker(void* arg) {
+	(void)arg;
+	regexCache cache;
+	memset(&cache, 0, sizeof(cache));
+
+	pthread_mutex_lock(&SE.lock);
+	while (1) {
+		while (SE.next_range >= SE.num_ranges || SE.paused) {
+			pthread_cond_wait(&SE.wake, &SE.lock);
+		}
+
+		int k = SE.next_range++;
+		unsigned int generation = SE.generation;
+		int icase = SE.icase;
+		regexProg* prog = SE.regex;
+		const char* pattern = prog ? prog->literal : SE.query;
+		int qlen = prog ? prog->literal_len : SE.qlen;
+		char* query = malloc(qlen + 1);
+		memcpy(query, pattern, qlen);
+		query[qlen] = '\0';
+		if (prog) ++prog->refs;
+		int from = k * SEARCH_RANGE_ROWS;
+		int to = from + SEARCH_RANGE_ROWS < SE.numrows ? from + SEARCH_RANGE_ROWS : SE.numrows;
+		++SE.busy;
+		pthread_mutex_unlock(&SE.lock);
+
+		/* a pattern that is plain text is left to the kernel alone */
+		regexCache* re = prog && !prog->literal_only ? &cache : NULL;
+		if (re && cache.generation != generation) {
+			regexCacheReset(&cache, prog, generation);
+		}
+		searchRange result = { 0, 0, 0, NULL };
+		int complete = editorSearchRows(from, to, query, qlen, icase, re, generation, &result);
+		free(query);
+
+		pthread_mutex_lock(&SE.lock);
+		if (--SE.busy == 0 && SE.paused) {
+			editorEventWake(); //rows wait to go in
+		}
+		if (prog && --prog->refs == 0 && prog != SE.regex) {
+			regexFree(prog);
+		}
+		if (complete && generation == SE.generation) {
+			result.done = 1;
+			SE.ranges[k] = result;
+			SE.finished[SE.done_ranges++] = k;
+			editorEventWake();
+		}
+		else {
+			free(result.matches);
+		}
+		pthread_cond_broadcast(&SE.idle);
+	}
 
-	++E.dirty;
+	return NULL;
 }
 
-void editorRowInsertChar(erow* row, int at, int c) {
-	if (at < 0 || at > row->size) {
-		at = row->size;
+/* hands the rows out to the workers for a new query; whatever is still
+ * running for the old one is dropped. Rows still loading are handed out by
+ * editorSearchResume as they come in */
+void editorSearchStart(const char* query) {
+	editorGapClose(); //workers read the rows whole
+
+	if (SE.num_workers == 0) {
+		pthread_mutex_init(&SE.lock, NULL);
+		pthread_cond_init(&SE.wake, NULL);
+		pthread_cond_init(&SE.idle, NULL);
+
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		int workers = cpus < 1 ? 1 : (cpus > SEARCH_MAX_WORKERS ? SEARCH_MAX_WORKERS : cpus);
+		for (int i = 0; i < workers; ++i) {
+			pthread_t thread;
+			if (pthread_create(&thread, NULL, editorSearchWorker, NULL) == 0) {
+				pthread_detach(thread);
+				++SE.num_workers;
+			}
+		}
+		if (SE.num_workers == 0) {
+			quit_error("pthread_create error in editorSearchStart");
+		}
 	}
-	row->chars = realloc(row->chars, row->size + 2);
-	memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
-	row->size++;
-	row->chars[at] = c;
-	editorUpdateRow(row);
-	++E.dirty;
-}
 
-void editorRowDelChar(erow* row, int at) {
-	if (at < 0 || at >= row->size) return;
+	const char* error = NULL;
+	regexProg* prog = E.search_regex && *query ? regexCompile(query, E.search_icase, &error) : NULL;
 
-	memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
-	row->size--;
-	editorUpdateRow(row);
-	E.dirty++;
-}
+	pthread_mutex_lock(&SE.lock);
+	__atomic_store_n(&SE.generation, SE.generation + 1, __ATOMIC_RELAXED);
 
-/* editor operations func realization */
-void editorInsertChar(int c) {
-	if (E.cursor_y == E.numrows) {
-		editorInsertRow(E.numrows, "", 0);
+	for (int k = 0; k < SE.num_ranges; ++k) {
+		free(SE.ranges[k].matches);
+	}
+	free(SE.ranges);
+	free(SE.finished);
+	free(SE.query);
+	if (SE.regex && SE.regex->refs == 0) {
+		regexFree(SE.regex); //else the last worker using it frees it
 	}
 
-	editorRowInsertChar(&E.row[E.cursor_y], E.cursor_x, c);
-	E.cursor_x++;
+	SE.qlen = strlen(query);
+	SE.query = malloc(SE.qlen + 1);
+	memcpy(SE.query, query, SE.qlen + 1);
+	SE.icase = E.search_icase;
+	SE.regex = prog;
+	SE.regex_error = error;
+	SE.growing = SE.qlen && !error; //editorSearchResume hands the rows out
+	SE.numrows = 0;
+	SE.num_ranges = 0;
+	SE.ranges = NULL;
+	SE.finished = NULL;
+	SE.next_range = 0;
+	SE.done_ranges = 0;
+	pthread_mutex_unlock(&SE.lock);
+
+	SE.merged = 0;
+	SE.prefix = 0;
+	SE.num_matches = 0;
+	SE.selected = 0;
+	SE.jump = 1;
+	SE.pending = 0;
+	editorSearchResume();
 }
 
-void editorInsertNewline() {
-	if (E.cursor_x == 0) {
-		editorInsertRow(E.cursor_y, "", 0);
-	}
-	else {
-		erow* row = &E.row[E.cursor_y];
-		editorInsertRow(E.cursor_y + 1, &row->chars[E.cursor_x], row->size - E.cursor_x);
-		row = &E.row[E.cursor_y];
-		row->size = E.cursor_x;
-		row->chars[row->size] = '\0';
-		editorUpdateRow(row);
+/* drops the running scan and waits for the workers to leave the rows, after
+ * which the buffer may change again */
+void editorSearchStop() {
+	if (SE.num_workers) {
+		pthread_mutex_lock(&SE.lock);
+		__atomic_store_n(&SE.generation, SE.generation + 1, __ATOMIC_RELAXED);
+		SE.next_range = SE.num_ranges;
+		while (SE.busy) {
+			pthread_cond_wait(&SE.idle, &SE.lock);
+		}
+		SE.merged = SE.done_ranges; //ranges done just before are not merged later
+		SE.growing = 0;
+		pthread_mutex_unlock(&SE.lock);
 	}
+	editorSaveRebase(); //a save that finished meanwhile
 
-	++E.cursor_y;
-	E.cursor_x = 0;
+	SE.num_matches = 0;
+	SE.selected = 0;
+	SE.jump = 0;
+	SE.pending = 0;
 }
 
-void editorDelChar() {
-	if (E.cursor_y == E.numrows) return;
-	if (E.cursor_x == 0 && E.cursor_y == 0) return;
+/* keeps the workers out of the rows while loading appends to them: no range
+ * is handed out from now on. Returns whether none is running any more; with
+ * wait the running ones are waited for */
+int editorSearchPause(int wait) {
+	if (SE.num_workers == 0) return 1;
 
-	erow* row = &E.row[E.cursor_y];
-	if (E.cursor_x > 0) {
-		editorRowDelChar(row, E.cursor_x - 1);
-		--E.cursor_x;
+	pthread_mutex_lock(&SE.lock);
+	SE.paused = 1;
+	while (wait && SE.busy) {
+		pthread_cond_wait(&SE.idle, &SE.lock);
 	}
-	else {
-		E.cursor_x = E.row[E.cursor_y - 1].size;
-		editorRowAppendString(&E.row[E.cursor_y - 1], row->chars, row->size);
-		editorDelRow(E.cursor_y);
-		--E.cursor_y;
+	int idle = SE.busy == 0;
+	pthread_mutex_unlock(&SE.lock);
+
+	return idle;
+}
+
+/* lets the workers go on, with ranges for the rows that came in meanwhile.
+ * While the file loads only whole ranges are handed out, the last one
+ * follows once it is in */
+void editorSearchResume() {
+	if (SE.num_workers == 0) return;
+
+	pthread_mutex_lock(&SE.lock);
+	if (SE.growing) {
+		int num = LD.active ? E.numrows / SEARCH_RANGE_ROWS : (E.numrows + SEARCH_RANGE_ROWS - 1) / SEARCH_RANGE_ROWS;
+		if (num > SE.num_ranges) {
+			SE.ranges = realloc(SE.ranges, sizeof(searchRange) * num);
+			SE.finished = realloc(SE.finished, sizeof(int) * num);
+			if (SE.ranges == NULL || SE.finished == NULL) {
+				quit_error("realloc error in editorSearchResume");
+			}
+			memset(&SE.ranges[SE.num_ranges], 0, sizeof(searchRange) * (num - SE.num_ranges));
+			SE.num_ranges = num;
+		}
+		SE.numrows = E.numrows;
+		SE.growing = LD.active;
 	}
+	SE.paused = 0;
+	pthread_cond_broadcast(&SE.wake);
+	pthread_mutex_unlock(&SE.lock);
 }
 
-/* file input/output func realization */
-char* editorRowsToString(int* bufflen) {
-	int totallen = 0;
-	for (int j = 0; j < E.numrows; ++j) {
-		totallen += E.row[j].size + 1;
+/* merges the ranges the workers finished since the last call into the match
+ * index and returns 1 if the screen has to be drawn again. Once the first
+ * match of the file is known it is selected and a key held back for it is
+ * acted on */
+int editorSearchPoll() {
+	if ((!SE.active && !SE.pending) || SE.num_workers == 0) return 0;
+
+	pthread_mutex_lock(&SE.lock);
+	if (SE.done_ranges == SE.merged && !(SE.jump && SE.prefix == SE.num_ranges && !SE.growing)) {
+		pthread_mutex_unlock(&SE.lock);
+		return 0;
 	}
-	*bufflen = totallen;
 
-	char* buff = malloc(totallen);
-	char* p= buff;
+	for (; SE.merged < SE.done_ranges; ++SE.merged) {
+		editorSearchMerge(&SE.ranges[SE.finished[SE.merged]], SE.finished[SE.merged]);
+	}
 
-	for (int j = 0; j < E.numrows; ++j) {
-		memcpy(p, E.row[j].chars, E.row[j].size);
-		p += E.row[j].size;
-		*p = '\n';
-		++p;
+	/* ranges follow the row order, so the first match of the file is known
+	 * once it lies within the ranges that are done from the start on */
+	while (SE.prefix < SE.num_ranges && SE.ranges[SE.prefix].done) {
+		++SE.prefix;
+	}
+	int first = SE.jump && ((SE.prefix == SE.num_ranges && !SE.growing) ||
+			(SE.num_matches && SE.matches[0].row < SE.prefix * SEARCH_RANGE_ROWS));
+	pthread_mutex_unlock(&SE.lock);
+
+	if (first) {
+		SE.jump = 0;
+		if (SE.num_matches) {
+			editorSearchSelect(0);
+		}
+		int key = SE.pending;
+		SE.pending = 0;
+		if (key) {
+			editorSearchKey(key);
+		}
 	}
 
-	return buff;
+	return 1;
 }
 
-void editorOpen(char* filename) {
-	free(E.filename);
-	E.filename = strdup(filename);
+/* puts the matches of range k in place in the sorted index; ranges mostly
+ * finish in order, so that is an append */
+void editorSearchMerge(searchRange* range, int k) {
+	if (SE.num_matches + range->count > SE.matches_cap) {
+		while (SE.num_matches + range->count > SE.matches_cap) {
+			SE.matches_cap = SE.matches_cap ? SE.matches_cap * 2 : 1024;
+		}
+		SE.matches = realloc(SE.matches, sizeof(searchMatch) * SE.matches_cap);
+		if (SE.matches == NULL) {
+			quit_error("realloc error in editorSearchMerge");
+		}
+	}
 
-	editorSelectSyntaxHighlight();
+	int at = editorSearchLowerBound(k * SEARCH_RANGE_ROWS, 0);
+	memmove(&SE.matches[at + range->count], &SE.matches[at], sizeof(searchMatch) * (SE.num_matches - at));
+	memcpy(&SE.matches[at], range->matches, sizeof(searchMatch) * range->count);
+	SE.num_matches += range->count;
 
-	FILE* fp = fopen(filename, "r");
-	if (!fp) {
-		quit_error("error opening file; editorOpen func");
+	free(range->matches);
+	range->matches = NULL;
+}
+
+/* acts on the selected match for a key of the search prompt: the arrows
+ * step through the matches, Enter ends the search on it */
+void editorSearchKey(int key) {
+	if (key == '\r') {
+		editorSearchStop();
+		return;
 	}
-	char* line = NULL;
-	size_t linecap = 0;
-	ssize_t linelen;
-	while ((linelen = getline(&line, &linecap, fp)) != -1) {
-		while (linelen > 0 && (line[linelen - 1] == '\n' ||
-							line[linelen - 1] == '\r')) {
-			--linelen;
-		}
-		editorInsertRow(E.numrows, line, linelen);
+	if (!SE.selected || SE.num_matches == 0) return;
+
+	if (key == ARROW_RIGHT || key == ARROW_DOWN) {
+		int i = editorSearchLowerBound(SE.sel_row, SE.sel_cx + 1);
+		editorSearchSelect(i == SE.num_matches ? 0 : i);
+	}
+	else {
+		int i = editorSearchLowerBound(SE.sel_row, SE.sel_cx) - 1;
+		editorSearchSelect(i < 0 ? SE.num_matches - 1 : i);
 	}
-	free(line);
-	fclose(fp);
-	E.dirty = 0;
 }
 
-void editorSave() {
-	if (E.filename == NULL) {
-		E.filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
-		if (E.filename == NULL) {
-			editorSetStatusMessage("Save aborted!");
-			return;
-		}
-		editorSelectSyntaxHighlight();
+/* waits until every range is scanned, after which the workers are idle and
+ * the buffer may change while the matches are kept */
+void editorSearchWaitAll() {
+	editorLoadPoll(1); //the rows still loading are searched as well
+
+	pthread_mutex_lock(&SE.lock);
+	while (SE.done_ranges < SE.num_ranges || SE.busy) {
+		pthread_cond_wait(&SE.idle, &SE.lock);
 	}
+	pthread_mutex_unlock(&SE.lock);
 
-	int len;
-	char* buff = editorRowsToString(&len);
+	editorSearchPoll();
+}
 
-	int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
-	if (fd != -1) {
-		if (ftruncate(fd, len) != -1) {
-			if (write(fd, buff, len) == len) {
-				close(fd);
-				free(buff);
-				E.dirty = 0;
-				editorSetStatusMessage("%d bytes written to disk", len);
-				return;
-			}
+/* index of the first match at or after row and cx */
+int editorSearchLowerBound(int row, int cx) {
+	int lo = 0, hi = SE.num_matches;
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		searchMatch* m = &SE.matches[mid];
+		if (m->row < row || (m->row == row && m->cx < cx)) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
 		}
-		close(fd);
 	}
-	free(buff);
-	editorSetStatusMessage("Cant save! I/O error: %s", strerror(errno));
-}
 
-/* find func realization */
-void editorFindCallback(char* query, int key) {
-	static int last_match = -1;
-	static int direction = 1;
+	return lo;
+}
 
-	static int saved_hl_line;
-	static char* saved_hl = NULL;
+/* moves the cursor onto match i, scrolling it to the top of the screen */
+void editorSearchSelect(int i) {
+	SE.selected = 1;
+	SE.sel_row = SE.matches[i].row;
+	SE.sel_cx = SE.matches[i].cx;
 
-	if (saved_hl) {
-		memcpy(E.row[saved_hl_line].hl, saved_hl, E.row[saved_hl_line].render_size);
-		free(saved_hl);
-		saved_hl = NULL;
-	}
+	E.cursor_y = SE.sel_row;
+	E.cursor_x = SE.sel_cx;
+	E.rowoffset = E.numrows;
+}
 
-	if (key == '\r' || key == '\x1b') {
-		last_match = -1;
-		direction = 1;
+/* find func realization */
+void editorFindCallback(char* query, int key) {
+	if (key == '\x1b') {
+		editorSearchStop();
 		return;
 	}
-	else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
-		direction = 1;
+	else if (key == '\r' || key == ARROW_RIGHT || key == ARROW_DOWN || key == ARROW_LEFT || key == ARROW_UP) {
+		/* when typing has got ahead of the scan the key waits for the first
+		 * match, the keys after it are held back in editorEventWait */
+		if (SE.jump) {
+			SE.pending = key;
+		}
+		else {
+			editorSearchKey(key);
+		}
+	}
+	else {
+		if (key == '\t') {
+			E.search_icase = !E.search_icase;
+		}
+		else if (key == CTRL_KEY('r')) {
+			E.search_regex = !E.search_regex;
+		}
+		editorSearchStart(query);
 	}
-	else if (key == ARROW_LEFT || key == ARROW_UP) {
-		direction = -1;
+}
+
+void editorFind() {
+	int saved_cursor_x = E.cursor_x;
+	int saved_cursor_y = E.cursor_y;
+	int saved_coloffset = E.coloffset;
+	int saved_rowoffset = E.rowoffset;
+
+	SE.active = 1;
+	char* query = editorPrompt("Search: %s (ESC/Arrows/Enter, Tab case, Ctrl-R regex)", editorFindCallback, 0);
+	SE.active = 0; //an Enter still pending ends the search once the first match is selected
+
+	if (query) {
+		free(query);
 	}
 	else {
-		last_match = -1;
-		direction = 1;
+		E.cursor_x = saved_cursor_x;
+		E.cursor_y = saved_cursor_y;
+		E.coloffset = saved_coloffset;
+		E.rowoffset = saved_rowoffset;
+	}
+}
+
+/* replace func realization */
+/* rewrites a row with its n matches, sorted by cx, replaced in one pass */
+void editorReplaceRow(erow* row, searchMatch* m, int n, const char* with, int wlen) {
+	const char* text = editorRowText(row);
+	int size = row->size;
+	for (int i = 0; i < n; ++i) {
+		size += wlen - m[i].len;
 	}
 
-	if (last_match == -1) {
-		direction = 1;
+	unsigned char text_slab;
+	char* chars = editorTextAlloc(size + 1, &text_slab);
+	int from = 0, to = 0;
+	for (int i = 0; i < n; ++i) {
+		editorEditRecord(EDIT_SPLICE, m[i].row, to + m[i].cx - from, &text[m[i].cx], m[i].len, with, wlen);
+		memcpy(&chars[to], &text[from], m[i].cx - from);
+		to += m[i].cx - from;
+		memcpy(&chars[to], with, wlen);
+		to += wlen;
+		from = m[i].cx + m[i].len;
 	}
-	int current = last_match;
-	for (int i = 0; i < E.numrows; ++i) {
-		current += direction;
-		if (current == -1) {
-			current = E.numrows - 1;
+	memcpy(&chars[to], &text[from], row->size - from);
+	chars[size] = '\0';
+
+	int old = row->size;
+	editorRowDropChars(row);
+	row->chars = chars;
+	row->text_slab = text_slab;
+	row->size = size;
+	editorRowEdited(row, 0, old, size);
+	row->flags |= ROW_DIRTY;
+}
+
+/* replaces the sorted matches, each affected row is rewritten once and the
+ * rows go to the highlighter together, so comment states are propagated in
+ * one walk; E.dirty goes up once for the whole batch. Returns the number of
+ * replacements */
+int editorReplaceMatches(searchMatch* m, int n, const char* with) {
+	int wlen = strlen(with);
+	erow* row = NULL;
+	int at = -1;
+
+	for (int i = 0; i < n; ) {
+		int j = i;
+		while (j < n && m[j].row == m[i].row) ++j;
+
+		/* near rows are reached by walking, far ones through the tree */
+		if (row && m[i].row - at < 64) {
+			while (at < m[i].row) {
+				row = editorRowNext(row);
+				++at;
+			}
 		}
-		else if (current == E.numrows) {
-			current = 0;
+		else {
+			at = m[i].row;
+			row = editorRowAt(at);
 		}
 
-		erow* row = &E.row[current];
-		char* match = strstr(row->render, query);
-		if (match) {
-			last_match = current;
-			E.cursor_y = current;
-			E.cursor_x = editorRowRxToCx(row, match - row->render);
-			E.rowoffset = E.numrows;
-
-			saved_hl_line = current;
-			saved_hl = malloc(row->render_size);
-			memcpy(saved_hl, row->hl, row->render_size);
-			memset(&row->hl[match - row->render], HL_MATCH, strlen(query));
-			break;
+		editorReplaceRow(row, &m[i], j - i, with, wlen);
+		if (E.syntax) {
+			editorSyntaxDirty(at);
 		}
+		i = j;
+	}
+
+	if (n) {
+		++E.dirty;
+		editorSyntaxSettle(E.rowoffset + E.screenrows, HL_SYNC_BUDGET);
 	}
+
+	return n;
 }
 
-void editorFind() {
+/* the search prompt of replace: Enter waits for the whole file to be
+ * scanned and keeps the matches */
+void editorReplaceCallback(char* query, int key) {
+	if (key == '\r') {
+		editorSearchWaitAll();
+		return;
+	}
+
+	editorFindCallback(query, key);
+}
+
+/* asks for a query and its replacement, then steps through the matches from
+ * the cursor on: y replaces one, n skips it, a replaces it and all the rest
+ * in one batch */
+void editorReplace() {
 	int saved_cursor_x = E.cursor_x;
 	int saved_cursor_y = E.cursor_y;
 	int saved_coloffset = E.coloffset;
 	int saved_rowoffset = E.rowoffset;
 
-	char* query = editorPrompt("Search: %s (press ESC/Arrows/Enter)", editorFindCallback);
+	SE.active = 1;
+	char* query = editorPrompt("Replace: %s (ESC/Arrows/Enter, Tab case, Ctrl-R regex)", editorReplaceCallback, 0);
+	char* with = query ? editorPrompt("Replace with: %s (ESC to cancel)", NULL, 1) : NULL;
+
+	int replaced = 0;
+	if (with) {
+		int n = SE.num_matches;
+		int first = editorSearchLowerBound(saved_cursor_y, saved_cursor_x);
+		int wlen = strlen(with);
+
+		/* handled matches get len 0, so they are not drawn and the ones left
+		 * for a are those still holding a length */
+		for (int k = 0; k < n; ++k) {
+			int i = (first + k) % n;
+			editorSearchSelect(i);
+			editorSetStatusMessage("Replace with \"%s\"? (y)es (n)o (a)ll the rest, ESC to stop", with);
+			editorRefreshScreen();
+
+			int c = editorReadKey();
+			if (c == 'y') {
+				int delta = wlen - SE.matches[i].len;
+				replaced += editorReplaceMatches(&SE.matches[i], 1, with);
+				E.cursor_x += wlen;
+				for (int j = i + 1; j < n && SE.matches[j].row == SE.matches[i].row; ++j) {
+					SE.matches[j].cx += delta;
+				}
+				SE.matches[i].len = 0;
+			}
+			else if (c == 'n') {
+				SE.matches[i].len = 0;
+			}
+			else if (c == 'a') {
+				int left = 0;
+				for (int j = 0; j < n; ++j) {
+					if (SE.matches[j].len) SE.matches[left++] = SE.matches[j];
+				}
+				replaced += editorReplaceMatches(SE.matches, left, with);
+				break;
+			}
+			else {
+				break;
+			}
+		}
 
-	if (query) {
-		free(query);
+		erow* row = editorRowAt(E.cursor_y);
+		if (row && E.cursor_x > row->size) {
+			E.cursor_x = row->size;
+		}
 	}
 	else {
 		E.cursor_x = saved_cursor_x;
@@ -884,10 +6521,19 @@ void editorFind() {
 		E.coloffset = saved_coloffset;
 		E.rowoffset = saved_rowoffset;
 	}
+
+	editorSearchStop();
+	SE.active = 0;
+	if (with) {
+		editorSetStatusMessage("Replaced %d occurrence%s", replaced, replaced == 1 ? "" : "s");
+	}
+	free(query);
+	free(with);
 }
 
 /* input func realization */
-char* editorPrompt(char* prompt, void (*callback)(char*, int)) {
+/* allow_empty lets Enter accept an empty answer */
+char* editorPrompt(char* prompt, void (*callback)(char*, int), int allow_empty) {
 	size_t buffsize = 128;
 	char* buff = malloc(buffsize);
 
@@ -913,7 +6559,7 @@ char* editorPrompt(char* prompt, void (*callback)(char*, int)) {
 				}
 		}
 		else if (c == '\r') {
-			if (bufflen != 0) {
+			if (bufflen != 0 || allow_empty) {
 				editorSetStatusMessage("");
 				if (callback) {
 					callback(buff, c);
@@ -937,7 +6583,7 @@ char* editorPrompt(char* prompt, void (*callback)(char*, int)) {
 }
 
 void editorMoveCursor(int key) {
-	erow* row = (E.cursor_y >= E.numrows) ? NULL : &E.row[E.cursor_y];
+	erow* row = editorRowAt(E.cursor_y);
 	switch (key) {
 		case ARROW_LEFT:
 			if (E.cursor_x != 0) {
@@ -945,7 +6591,7 @@ void editorMoveCursor(int key) {
 			}
 			else if (E.cursor_y > 0) {
 				--E.cursor_y;
-				E.cursor_x = E.row[E.cursor_y].size;
+				E.cursor_x = editorRowAt(E.cursor_y)->size;
 			}
 			break;
 		case ARROW_RIGHT:
@@ -976,7 +6622,7 @@ void editorMoveCursor(int key) {
 		E.cursor_y = E.numrows - 1;
 	}
 
-	row = (E.cursor_y >= E.numrows) ? NULL : &E.row[E.cursor_y];
+	row = editorRowAt(E.cursor_y);
 	int rowlen = row ? row->size : 0;
 	if (E.cursor_x > rowlen) {
 		E.cursor_x = rowlen;
@@ -985,8 +6631,10 @@ void editorMoveCursor(int key) {
 
 void editorProcessKeypress() {
 	static int quit_times = CTRLC_QUIT_TIMES;
+	static int last_key = 0;
 
 	int c = editorReadKey();
+	editorUndoBoundary();
 
 	switch (c) {
 		case '\r':
@@ -994,6 +6642,8 @@ void editorProcessKeypress() {
 			break;
 
 		case CTRL_KEY('q'):
+			/* a save still writing is let finish, it may be what clears dirty */
+			editorSavePoll(1);
 			if (E.dirty && quit_times > 0) {
 				editorSetStatusMessage(
 						"WARNING!!! File has unsaved changes. "
@@ -1002,6 +6652,7 @@ void editorProcessKeypress() {
 				--quit_times;
 				return;
 			}
+			editorJournalRemove();
 			write(STDOUT_FILENO, "\x1b[2J", 4);
 			write(STDOUT_FILENO, "\x1b[H", 3);
 			exit(EXIT_SUCCESS);
@@ -1044,7 +6695,7 @@ void editorProcessKeypress() {
 
 		case END:
 			if (E.cursor_y < E.numrows) {
-				E.cursor_x = E.row[E.cursor_y].size;
+				E.cursor_x = editorRowAt(E.cursor_y)->size;
 			}
 			break;
 
@@ -1052,6 +6703,18 @@ void editorProcessKeypress() {
 			editorFind();
 			break;
 
+		case CTRL_KEY('r'):
+			editorReplace();
+			break;
+
+		case CTRL_KEY('z'):
+			editorUndo();
+			break;
+
+		case CTRL_KEY('y'):
+			editorRedo();
+			break;
+
 		case BACKSPACE:
 		case CTRL_KEY('h'):
 		case DELETE:
@@ -1062,22 +6725,45 @@ void editorProcessKeypress() {
 			break;
 
 		case CTRL_KEY('l'):
+			E.repaint = 1;
+			break;
+
+		case CTRL_KEY('t'):
+			/* pressed again it shows row storage, then frames again */
+			if (last_key == CTRL_KEY('t')) {
+				editorShowRowStats();
+				c = 0;
+			}
+			else {
+				editorShowFrameStats();
+			}
+			break;
+
+		case PASTE_START:
+			editorPaste();
+			break;
+
 		case '\x1b':
+		case PASTE_END:
 			break;
 
 		default:
+			/* keys that piled up behind this one, as when a terminal
+			 * without bracketed paste pastes, go in as one insert */
+			if (editorTypeAhead(c)) break;
 			editorInsertChar(c);
 			break;
 	}
 
 	quit_times = CTRLC_QUIT_TIMES;
+	last_key = c;
 }
 
 /* output func realization */
 void editorScroll() {
 	E.render_x = 0;
 	if (E.cursor_y < E.numrows) {
-		E.render_x = editorRowCxToRx(&E.row[E.cursor_y], E.cursor_x);
+		E.render_x = editorRowCxToRx(editorRowAt(E.cursor_y), E.cursor_x);
 	}
 
 	if (E.cursor_y < E.rowoffset) {
@@ -1097,7 +6783,159 @@ void editorScroll() {
 	}
 }
 
-void editorDrawRows(struct abuf* ab) {
+/* picks up a changed terminal size; the framebuffers are rebuilt to match
+ * and the next frame is painted from scratch */
+void editorFrameResize() {
+	struct winsize ws;
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) != -1 && ws.ws_col != 0) {
+		E.screenrows = ws.ws_row - 2;
+		E.screencols = ws.ws_col - LINENUM_MARGIN;
+	}
+
+	int rows = E.screenrows + 2;
+	int cols = E.screencols + LINENUM_MARGIN;
+	if (E.frame && rows == E.frame_rows && cols == E.frame_cols) return;
+
+	free(E.frame);
+	free(E.shown);
+	E.frame = malloc(sizeof(cell) * rows * cols);
+	E.shown = malloc(sizeof(cell) * rows * cols);
+	if (E.frame == NULL || E.shown == NULL) {
+		quit_error("malloc error in editorFrameResize");
+	}
+	E.frame_rows = rows;
+	E.frame_cols = cols;
+	E.repaint = 1;
+}
+
+/* writes len characters into the frame at row y, column x, clipped to the
+ * right edge of the terminal */
+void editorFramePut(int y, int x, const char* s, int len, unsigned char attr) {
+	if (x + len > E.frame_cols) len = E.frame_cols - x;
+
+	cell* c = &E.frame[y * E.frame_cols + x];
+	for (int i = 0; i < len; ++i) {
+		c[i].ch = s[i];
+		c[i].attr = attr;
+	}
+}
+
+void editorFrameInitAttrs() {
+	for (int attr = 0; attr < 256; ++attr) {
+		int color = attr & ~ATTR_INVERSE;
+		attr_escape_len[attr] = snprintf(attr_escape[attr], sizeof(attr_escape[attr]), "\x1b[%s;%dm",
+				(attr & ATTR_INVERSE) ? "7" : "27", color ? color : 39);
+	}
+}
+
+void editorFrameAttr(struct abuf* ab, unsigned char attr) {
+	abAppend(ab, attr_escape[attr], attr_escape_len[attr]);
+}
+
+/* emits only the spans of each line that differ from what the terminal
+ * already shows; a span reaching into the blank tail of a line is cut at
+ * its last visible cell and finished with an erase to the line end */
+void editorFrameFlush(struct abuf* ab) {
+	int cols = E.frame_cols;
+	int attr = 0;
+	char buf[32];
+	int len;
+
+	abAppend(ab, "\x1b[m", 3);
+
+	/* a vertical scroll moves the lines already on screen with the
+	 * terminal's own scrolling, inside a region that keeps the two bars in
+	 * place, so that only the lines scrolled in are left to draw */
+	int shift = E.rowoffset - E.shown_rowoffset;
+	if (!E.repaint && shift != 0 && abs(shift) < E.screenrows) {
+		int n = abs(shift);
+		len = snprintf(buf, sizeof(buf), "\x1b[1;%dr\x1b[%d%c\x1b[r",
+				E.screenrows, n, shift > 0 ? 'S' : 'T');
+		abAppend(ab, buf, len);
+
+		int kept = (E.screenrows - n) * cols;
+		cell* exposed;
+		if (shift > 0) {
+			memmove(E.shown, &E.shown[n * cols], sizeof(cell) * kept);
+			exposed = &E.shown[kept];
+		}
+		else {
+			memmove(&E.shown[n * cols], E.shown, sizeof(cell) * kept);
+			exposed = E.shown;
+		}
+		for (int i = 0; i < n * cols; ++i) {
+			exposed[i].ch = ' ';
+			exposed[i].attr = 0;
+		}
+	}
+	E.shown_rowoffset = E.rowoffset;
+
+	for (int y = 0; y < E.frame_rows; ++y) {
+		cell* now = &E.frame[y * cols];
+		cell* old = &E.shown[y * cols];
+
+		int first = 0;
+		if (!E.repaint) {
+			while (first < cols && now[first].ch == old[first].ch && now[first].attr == old[first].attr) {
+				++first;
+			}
+			if (first == cols) continue;
+		}
+
+		int last = cols - 1;
+		if (!E.repaint) {
+			while (now[last].ch == old[last].ch && now[last].attr == old[last].attr) {
+				--last;
+			}
+		}
+
+		int end = cols;
+		while (end > first && now[end - 1].ch == ' ' && now[end - 1].attr == 0) {
+			--end;
+		}
+		int erase = last >= end;
+		if (erase) last = end - 1;
+
+		len = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", y + 1, first + 1);
+		abAppend(ab, buf, len);
+
+		for (int x = first; x <= last; ) {
+			if (now[x].attr != attr) {
+				attr = now[x].attr;
+				editorFrameAttr(ab, attr);
+			}
+
+			int run = x + 1;
+			while (run <= last && now[run].attr == attr) ++run;
+			abAppendCells(ab, &now[x], run - x);
+			x = run;
+		}
+
+		if (erase) {
+			if (attr != 0) {
+				attr = 0;
+				abAppend(ab, "\x1b[m", 3);
+			}
+			abAppend(ab, "\x1b[K", 3);
+		}
+	}
+
+	if (attr != 0) {
+		abAppend(ab, "\x1b[m", 3);
+	}
+
+	memcpy(E.shown, E.frame, sizeof(cell) * E.frame_rows * cols);
+	E.repaint = 0;
+}
+
+void editorDrawRows() {
+	E.hl_provisional = 0;
+	editorSyntaxSettle(E.rowoffset + E.screenrows - 1, HL_SYNC_BUDGET);
+
+	/* search matches are laid over the highlight instead of written into it */
+	int m = SE.active ? editorSearchLowerBound(E.rowoffset, 0) : SE.num_matches;
+
+	erow* row = editorRowAt(E.rowoffset);
 	for (int i = 0; i < E.screenrows; ++i) {
 		int filerow = i + E.rowoffset;
 		if (filerow >= E.numrows) {
@@ -1110,16 +6948,12 @@ void editorDrawRows(struct abuf* ab) {
 				}
 				int padding = (E.screencols - welcome_msg_len) / 2;
 				if (padding) {
-					abAppend(ab, "~>", 2);
-					padding -= 2;
+					editorFramePut(i, 0, "~>", 2, 0);
 				}
-				while (padding--) {
-					abAppend(ab, " ", 1);
-				}
-				abAppend(ab, welcome_msg, welcome_msg_len);
+				editorFramePut(i, padding, welcome_msg, welcome_msg_len, 0);
 			}
 			else {
-				abAppend(ab, "~>", 2);
+				editorFramePut(i, 0, "~>", 2, 0);
 			}
 		}
 		else {
@@ -1138,107 +6972,129 @@ void editorDrawRows(struct abuf* ab) {
 			else {
 				snprintf(linenum_buf, sizeof(linenum_buf), " %*d ", linenum_width, filerow + 1);
 			}
-			abAppend(ab, linenum_buf, strlen(linenum_buf));
+			int x = strlen(linenum_buf);
+			editorFramePut(i, 0, linenum_buf, x, 0);
+
+			editorRowPrepare(row, filerow);
 
-			int len = E.row[filerow].render_size - E.coloffset;
+			int col = E.coloffset - (row->lex ? row->lex->render_from : 0); //long rows hold a window
+			int len = row->cache->render_size - col;
 			if (len < 0) {
 				len = 0;
 			}
 			if (len > E.screencols) {
 				len = E.screencols;
 			}
-			char* c = &E.row[filerow].render[E.coloffset];
-			unsigned char* hl = &E.row[filerow].hl[E.coloffset];
-			int current_color = -1;
-			for (int j = 0; j < len; ++j) {
-				if (iscntrl(c[j])) {
-					char sym = (c[j] <= 26) ? '@' + c[j] : '?';
-					abAppend(ab, "\x1b[7m", 4);
-					abAppend(ab, &sym, 1);
-					abAppend(ab, "\x1b[m", 3);
-					if (current_color != -1) {
-						char buf[16];
-						int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", current_color);
-						abAppend(ab, buf, clen);
+			char* c = &row->cache->render[col];
+			if (len > E.frame_cols - x) {
+				len = E.frame_cols - x;
+			}
+			/* put each span at once, control characters go inverted on their own */
+			hlSpan* span = len > 0 ? &row->cache->spans[editorCacheSpanAt(row->cache, col)] : NULL;
+			for (int j = 0; j < len; ++span) {
+				int to = span->end - col < len ? span->end - col : len;
+				unsigned char attr = span->hl == HL_NORMAL ? 0 : editorSyntaxToColor(span->hl);
+				while (j < to) {
+					if (iscntrl(c[j])) {
+						char sym = (c[j] <= 26) ? '@' + c[j] : '?';
+						editorFramePut(i, x + j, &sym, 1, ATTR_INVERSE);
+						++j;
+						continue;
 					}
+
+					int run = j + 1;
+					while (run < to && !iscntrl(c[run])) ++run;
+					editorFramePut(i, x + j, &c[j], run - j, attr);
+					j = run;
 				}
-				else if (hl[j] == HL_NORMAL) {
-					if (current_color != -1) {
-						abAppend(ab, "\x1b[39m", 5);
-						current_color = -1;
-					}
-					abAppend(ab, &c[j], 1);
+			}
+
+			for (; m < SE.num_matches && SE.matches[m].row == filerow; ++m) {
+				int cx = SE.matches[m].cx;
+				int start = editorRowCxToRx(row, cx) - E.coloffset;
+				int end = editorRowCxToRx(row, cx + SE.matches[m].len) - E.coloffset;
+				unsigned char attr = editorSyntaxToColor(HL_MATCH);
+				if (SE.selected && SE.sel_row == filerow && SE.sel_cx == cx) {
+					attr |= ATTR_INVERSE;
 				}
-				else {
-					int color = editorSyntaxToColor(hl[j]);
-					if (color != current_color) {
-						current_color = color;
-						char buf[16];
-						int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
-						abAppend(ab, buf, clen);
-					}
-					abAppend(ab, &c[j], 1);
+
+				for (int j = start < 0 ? 0 : start; j < end && j < len; ++j) {
+					E.frame[i * E.frame_cols + x + j].attr = attr;
 				}
 			}
-			abAppend(ab, "\x1b[39m", 5);
-			//abAppend(ab, &E.row[filerow].render[E.coloffset], len);
+			row = editorRowNext(row);
 		}
-
-		abAppend(ab, "\x1b[K", 3); //erase the part of the line to the right of the cursor
-		abAppend(ab, "\r\n", 2);
-
 	}
 }
 
-void editorDrawStatusBar(struct abuf* ab) {
-	abAppend(ab, "\x1b[7m", 4);
+void editorDrawStatusBar() {
+	int y = E.screenrows;
 	char status[80], rstatus[80]; //rstatus stands for render status
 	int len = snprintf(status, sizeof(status), "%.20s%s - %d lines",
 			E.filename ? E.filename : "[No name]", E.dirty ? "{+}" : "", E.numrows);
 
 	int total_lines = E.numrows > 0 ? E.numrows : 1;
 	int current_line = E.numrows > 0 ? E.cursor_y + 1 : 0;
-	int rlen = snprintf(rstatus, sizeof(rstatus), "%s | %d/%d", //rlen stands for render length
+	char matches[48] = "";
+	if (SE.active && SE.regex_error) {
+		snprintf(matches, sizeof(matches), "%s | ", SE.regex_error);
+	}
+	else if (SE.active && SE.qlen) {
+		int k = SE.selected ? editorSearchLowerBound(SE.sel_row, SE.sel_cx) + 1 : 0;
+		snprintf(matches, sizeof(matches), "match %d of %d%s | ", k, SE.num_matches,
+				SE.merged < SE.num_ranges || SE.growing ? "+" : "");
+	}
+	int rlen = snprintf(rstatus, sizeof(rstatus), "%s%s%s%s | %d/%d", //rlen stands for render length
+			matches, E.search_icase ? "ignore case | " : "", E.search_regex ? "regex | " : "",
 			E.syntax ? E.syntax->filetype : "no filetype", current_line, total_lines);
 	if (len > E.screencols) {
 		len = E.screencols;
 	}
-	abAppend(ab, status, len);
+	editorFramePut(y, 0, status, len, ATTR_INVERSE);
 	while (len < E.screencols) {
 		if (E.screencols - len == rlen) {
-			abAppend(ab, rstatus, rlen);
+			editorFramePut(y, len, rstatus, rlen, ATTR_INVERSE);
 			break;
 		}
 		else {
-			abAppend(ab, " ", 1);
+			editorFramePut(y, len, " ", 1, ATTR_INVERSE);
 			++len;
 		}
 	}
-	abAppend(ab, "\x1b[m", 3);
-	abAppend(ab, "\r\n", 2);
 }
 
-void editorDrawMessageBar(struct abuf* ab) {
-	abAppend(ab, "\x1b[K", 3);
+void editorDrawMessageBar() {
 	int msglen = strlen(E.statusmsg);
 	if (msglen > E.screencols) msglen = E.screencols;
-	if (msglen && time(NULL) - E.statusmsg_time < 5) {
-		abAppend(ab, E.statusmsg, msglen);
+	if (msglen && time(NULL) - E.statusmsg_time < STATUSMSG_SECONDS) {
+		editorFramePut(E.screenrows + 1, 0, E.statusmsg, msglen, 0);
 	}
 }
 
 void editorRefreshScreen() {
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	editorFrameResize();
 	editorScroll();
 
-	struct abuf ab = ABUF_INIT;
+	for (int i = 0; i < E.frame_rows * E.frame_cols; ++i) {
+		E.frame[i].ch = ' ';
+		E.frame[i].attr = 0;
+	}
+	editorDrawRows();
+	editorTrimRowCache();
+	editorDrawStatusBar();
+	editorDrawMessageBar();
 
-	abAppend(&ab, "\x1b[?25l", 6); //hide the cursor
-	//abAppend(&ab, "\x1b[2J", 4);
-	abAppend(&ab, "\x1b[H", 3);
+	static struct abuf ab = ABUF_INIT; //kept between frames along with its capacity
+	ab.len = 0;
 
-	editorDrawRows(&ab);
-	editorDrawStatusBar(&ab);
-	editorDrawMessageBar(&ab);
+	if (E.sync_output) {
+		abAppend(&ab, "\x1b[?2026h", 8); //the terminal shows the frame only once it is complete
+	}
+	abAppend(&ab, "\x1b[?25l", 6); //hide the cursor
+	editorFrameFlush(&ab);
 
 	char buff[32];
 	snprintf(buff, sizeof(buff), "\x1b[%d;%dH",
@@ -1246,9 +7102,26 @@ void editorRefreshScreen() {
 	abAppend(&ab, buff, strlen(buff));
 
 	abAppend(&ab, "\x1b[?25h", 6); //show the cursor
+	if (E.sync_output) {
+		abAppend(&ab, "\x1b[?2026l", 8);
+	}
+
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	E.frame_us_last = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+	if (E.frame_us_last > E.frame_us_max) E.frame_us_max = E.frame_us_last;
+	E.frame_us_total += E.frame_us_last;
+	E.frame_bytes_last = ab.len;
+	++E.frames;
+	EV.redraw = 0;
 
 	write(STDOUT_FILENO, ab.b, ab.len);
-	abFree(&ab);
+}
+
+void editorShowFrameStats() {
+	editorSetStatusMessage("frame build: last %ld us, avg %lld us, max %ld us over %d frames, %d bytes",
+			E.frame_us_last, E.frame_us_total / (E.frames ? E.frames : 1), E.frame_us_max,
+			E.frames, E.frame_bytes_last);
 }
 
 void editorSetStatusMessage(const char* format, ...) {
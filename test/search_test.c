@@ -0,0 +1,100 @@
+/* search engine checks over a mapped buffer with CRLF and LF line ends,
+ * the way editorOpen leaves it: every match has to lie within its row, and
+ * the rows found through the kernel have to agree with matching each row
+ * on its own. build and run with `make test` */
+#define main ctrlc_main
+#include "../ctrlc.c"
+#undef main
+
+int failures = 0;
+
+/* matches of query over every row, through the kernel the way a search
+ * worker runs it */
+searchRange testEngine(regexProg* prog) {
+	regexCache cache;
+	memset(&cache, 0, sizeof(cache));
+	regexCacheReset(&cache, prog, SE.generation);
+
+	searchRange out = { 0, 0, 0, NULL };
+	editorSearchRows(0, E.numrows, prog->literal, prog->literal_len, 0,
+			prog->literal_only ? NULL : &cache, SE.generation, &out);
+	regexCacheFree(&cache);
+
+	return out;
+}
+
+/* matches of query running the regex over each row on its own */
+searchRange testRows(regexProg* prog) {
+	regexCache cache;
+	memset(&cache, 0, sizeof(cache));
+	regexCacheReset(&cache, prog, SE.generation);
+
+	searchRange out = { 0, 0, 0, NULL };
+	erow* row = editorRowAt(0);
+	for (int at = 0; row; ++at, row = editorRowNext(row)) {
+		editorSearchRegexRow(&cache, editorRowText(row), row->size, at, &out);
+	}
+	regexCacheFree(&cache);
+
+	return out;
+}
+
+void testQuery(const char* query) {
+	const char* error = NULL;
+	regexProg* prog = regexCompile(query, 0, &error);
+	if (prog == NULL) {
+		printf("FAIL %s: %s\n", query, error);
+		++failures;
+		return;
+	}
+
+	searchRange got = testEngine(prog);
+	searchRange want = testRows(prog);
+	int ok = got.count == want.count;
+	for (int i = 0; i < got.count; ++i) {
+		searchMatch* m = &got.matches[i];
+		if (m->cx + m->len > editorRowAt(m->row)->size) ok = 0;
+		if (i < want.count && (m->row != want.matches[i].row || m->cx != want.matches[i].cx ||
+				m->len != want.matches[i].len)) ok = 0;
+	}
+	printf("%s %-16s %d matches, %d expected\n", ok ? "ok  " : "FAIL", query, got.count, want.count);
+	if (!ok) ++failures;
+
+	free(got.matches);
+	free(want.matches);
+	regexFree(prog);
+}
+
+int main() {
+	const char* lines[] = { "ab", "a", "b", "xab\tab", "", "ba" };
+	size_t cap = 1 << 16;
+	char* text = malloc(cap);
+	size_t len = 0;
+	for (int i = 0; len < cap - 64; ++i) {
+		len += sprintf(text + len, i % 4 == 3 ? "%s\n" : "%s\r\n", lines[i % 6]);
+	}
+
+	E.rowtree = rtNewNode(1);
+	E.hl_pending = -1;
+	E.hl_dirty_end = -1;
+	E.map = text;
+	E.map_size = len;
+	loadRow* rows = malloc(sizeof(loadRow) * LOAD_BATCH_ROWS);
+	for (size_t pos = 0; pos < len; ) {
+		int n;
+		pos = editorLoadSplit(pos, rows, &n);
+		for (int i = 0; i < n; ++i) {
+			editorInsertMappedRow(E.numrows, rows[i].src, rows[i].len);
+		}
+	}
+
+	const char* queries[] = { "a\\x0d", "b\\x0a", "\\x0d\\x0aa", "ab\\x0d?", "ab", "b\\ta", "a|b", NULL };
+	for (int q = 0; queries[q]; ++q) {
+		testQuery(queries[q]);
+	}
+
+	free(rows);
+	free(text);
+
+	return failures != 0;
+}